@@ -0,0 +1,250 @@
+#include "benchmark.h"
+#include "defines.h"
+#include "job.h"
+#include "job_system.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// how jobs were laid out before the hot/cold split: the contended counter shares its line with name and dependants
+struct alignas(64) PackedJobLayout
+{
+	const char* Name;
+	Job* const* Dependants;
+	uint32_t NumDependants;
+	std::atomic_int_fast32_t UnfinishedJobs{ 1 };
+	JobFunction Function;
+};
+
+// same layout as Job: counter and function on the hot line, everything else on the cold one
+struct alignas(64) SplitJobLayout
+{
+	std::atomic_int_fast32_t UnfinishedJobs{ 1 };
+	JobFunction Function;
+	alignas(64) const char* Name;
+	Job* const* Dependants;
+	uint32_t NumDependants;
+};
+
+Benchmark::Benchmark(uint32_t numThreads)
+	: mNumThreads{ std::max(numThreads, 2U) }
+{
+}
+
+void Benchmark::Run()
+{
+	HTL_LOG("Running benchmarks with " << mNumThreads << " threads...");
+	RunJobLayout();
+	RunJobHandles();
+	RunStealing();
+}
+
+void Benchmark::RunJobLayout()
+{
+	HTL_LOG("---------- JOB LAYOUT (" << sizeof(Job) << " bytes per job) ----------");
+	RunJobLayoutContention<PackedJobLayout>("packed");
+	RunJobLayoutContention<SplitJobLayout>("hot/cold");
+}
+
+template <typename Layout>
+void Benchmark::RunJobLayoutContention(const char* layoutName)
+{
+	Layout* jobs = new Layout[NUM_JOBS];
+	for (uint32_t i = 0; i < NUM_JOBS; i++)
+	{
+		jobs[i].Name = "benchmark";
+		jobs[i].Dependants = nullptr;
+		jobs[i].NumDependants = i;
+	}
+
+	std::atomic_bool start{ false };
+	std::atomic_uint32_t runningWriters{ mNumThreads - 1 };
+
+	// like workers resolving dependencies: increment and decrement the counters of all jobs
+	std::vector<std::thread> writers;
+	for (uint32_t t = 0; t < mNumThreads - 1; t++)
+	{
+		writers.emplace_back([&]()
+		{
+			while (!start.load(std::memory_order_acquire));
+			for (uint32_t round = 0; round < NUM_COUNTER_ROUNDS; round++)
+			{
+				for (uint32_t i = 0; i < NUM_JOBS; i++)
+				{
+					jobs[i].UnfinishedJobs.fetch_add(1, std::memory_order_relaxed);
+					jobs[i].UnfinishedJobs.fetch_sub(1, std::memory_order_relaxed);
+				}
+			}
+			runningWriters.fetch_sub(1, std::memory_order_release);
+		});
+	}
+
+	// like a finishing worker walking its dependants: only reads the cold data
+	uint64_t numReads = 0;
+	uint64_t checksum = 0;
+	auto begin = std::chrono::high_resolution_clock::now();
+	start.store(true, std::memory_order_release);
+	while (runningWriters.load(std::memory_order_acquire) > 0)
+	{
+		for (uint32_t i = 0; i < NUM_JOBS; i++)
+		{
+			const volatile Layout& job = jobs[i];
+			checksum += job.NumDependants + (job.Dependants == nullptr) + job.Name[0];
+		}
+		numReads += NUM_JOBS;
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+
+	for (std::thread& writer : writers)
+	{
+		writer.join();
+	}
+	delete[] jobs;
+
+	double milliseconds = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000.0;
+	HTL_LOG(layoutName << ": counter updates took " << milliseconds << "ms, cold reads: "
+		<< (milliseconds > 0.0 ? numReads / milliseconds / 1000.0 : 0.0) << "M/s (checksum " << checksum % 10 << ")");
+}
+
+void Benchmark::RunJobHandles()
+{
+	HTL_LOG("---------- JOB HANDLES ----------");
+	JobSystem* jobSystem = new JobSystem(1, AffinityPolicy::None);
+	std::vector<JobHandle> handles(NUM_HANDLE_JOBS);
+
+	// the first frame grows the pool, all later ones reuse its slots
+	int64_t createNanoseconds = 0;
+	int64_t lookupNanoseconds = 0;
+	uint64_t numStale = 0;
+	for (uint32_t frame = 0; frame < NUM_HANDLE_FRAMES; frame++)
+	{
+		std::vector<JobHandle> lastFrame(handles);
+
+		auto begin = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < NUM_HANDLE_JOBS; i++)
+		{
+			handles[i] = jobSystem->CreateJob([]() {}, "handle");
+		}
+		auto created = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < NUM_HANDLE_JOBS; i++)
+		{
+			numStale += jobSystem->GetJob(handles[i]) == nullptr;
+			numStale += jobSystem->GetJob(lastFrame[i]) == nullptr;
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+
+		if (frame > 0)
+		{
+			createNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(created - begin).count();
+			lookupNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(end - created).count();
+		}
+		jobSystem->ResetJobs();
+	}
+	jobSystem->ShutDown();
+	delete jobSystem;
+
+	// every handle of the last frame points to a reused slot, so exactly half of the lookups have to fail
+	double numMeasured = static_cast<double>(NUM_HANDLE_JOBS) * (NUM_HANDLE_FRAMES - 1);
+	HTL_LOG("create: " << createNanoseconds / numMeasured << "ns per job, lookup: " << lookupNanoseconds / (2 * numMeasured)
+		<< "ns per handle, stale handles detected: " << numStale << " (expected " << static_cast<uint64_t>(NUM_HANDLE_JOBS) * NUM_HANDLE_FRAMES << ")");
+}
+
+// a bit of work, so stealing has a chance to happen while the producer is busy
+static void BusyWork(uint32_t iterations)
+{
+	volatile uint32_t sink = 0;
+	for (uint32_t i = 0; i < iterations; i++)
+	{
+		sink = sink + i;
+	}
+}
+
+void Benchmark::RunStealing()
+{
+	HTL_LOG("---------- STEALING ----------");
+	StealSettings settings;
+	settings.StealHalf = false;
+	RunStealingWith("single job", settings);
+
+	settings.StealHalf = true;
+	RunStealingWith("random", settings);
+
+	settings.LastVictimFirst = true;
+	RunStealingWith("last victim first", settings);
+
+	settings.LastVictimFirst = false;
+	settings.NumProbes = 2;
+	RunStealingWith("fullest of 2", settings);
+
+	settings.NumProbes = 4;
+	RunStealingWith("fullest of 4", settings);
+
+	settings.LastVictimFirst = true;
+	settings.NumProbes = 2;
+	RunStealingWith("last victim + fullest of 2", settings);
+}
+
+void Benchmark::RunStealingWith(const char* name, const StealSettings& settings)
+{
+	// not pinned, so the victim selection isn't mixed up with the topology tiers
+	JobSystem* jobSystem = new JobSystem(mNumThreads, AffinityPolicy::None);
+	jobSystem->SetStealSettings(settings);
+
+	auto begin = std::chrono::high_resolution_clock::now();
+	for (uint32_t round = 0; round < NUM_STEAL_ROUNDS; round++)
+	{
+		RunFanOut(*jobSystem);
+		RunParallelFor(*jobSystem);
+		jobSystem->ResetJobs();
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	jobSystem->ShutDown();
+
+	uint64_t attempts = 0;
+	uint64_t successes = 0;
+	uint64_t stolenJobs = 0;
+	for (uint32_t i = 0; i < jobSystem->GetNumWorkers(); i++)
+	{
+		attempts += jobSystem->GetWorkers()[i].GetStealAttempts();
+		successes += jobSystem->GetWorkers()[i].GetSuccessfulSteals();
+		stolenJobs += jobSystem->GetWorkers()[i].GetStolenJobs();
+	}
+	delete jobSystem;
+
+	double milliseconds = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000.0;
+	HTL_LOG(name << ": " << milliseconds << "ms, " << successes << " of " << attempts << " steal rounds succeeded ("
+		<< (attempts > 0 ? 100.0 * successes / attempts : 0.0) << "%), " << stolenJobs << " jobs stolen");
+}
+
+void Benchmark::RunFanOut(JobSystem& jobSystem)
+{
+	JobHandle children[NUM_FAN_OUT_JOBS];
+	JobHandle* childrenPointer = children;
+	JobSystem* jobSystemPointer = &jobSystem;
+	JobHandle producer = jobSystem.CreateJob([jobSystemPointer, childrenPointer]()
+	{
+		for (uint32_t i = 0; i < NUM_FAN_OUT_JOBS; i++)
+		{
+			childrenPointer[i] = jobSystemPointer->CreateJob([]() { BusyWork(200); }, "fan out");
+			jobSystemPointer->AddJob(childrenPointer[i]);
+		}
+		for (uint32_t i = 0; i < NUM_FAN_OUT_JOBS; i++)
+		{
+			jobSystemPointer->WaitFor(childrenPointer[i]);
+		}
+	}, "producer");
+	jobSystem.AddJob(producer);
+	jobSystem.WaitFor(producer);
+}
+
+void Benchmark::RunParallelFor(JobSystem& jobSystem)
+{
+	JobHandle job = jobSystem.CreateJob([&jobSystem]()
+	{
+		jobSystem.ParallelFor(0, NUM_PARALLEL_FOR_ITEMS, 64, [](uint32_t) { BusyWork(4); });
+	}, "parallel for root");
+	jobSystem.AddJob(job);
+	jobSystem.WaitFor(job);
+}
\ No newline at end of file
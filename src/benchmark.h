@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+
+struct StealSettings;
+class JobSystem;
+
+// general information
+// ===================
+// - Micro benchmarks for the job system, started with -b / --benchmark instead of the frame loop
+// - Numbers are only comparable on the same machine, contention effects need at least two cores
+
+class Benchmark
+{
+public:
+	explicit Benchmark(uint32_t numThreads);
+
+	void Run();
+
+private:
+	// workers hammering job counters while another thread reads the cold part of the same jobs,
+	// once with the counter sharing its line with name and dependants, once with the hot/cold split of Job
+	void RunJobLayout();
+
+	template <typename Layout>
+	void RunJobLayoutContention(const char* layoutName);
+
+	// creating jobs in the pool and looking up their handles, with the handles of the previous frame gone stale
+	void RunJobHandles();
+
+	// the same workloads with different steal settings, reports how many steal rounds got a job and how many jobs they took
+	void RunStealing();
+	void RunStealingWith(const char* name, const StealSettings& settings);
+
+	// one job spawns many small ones into its own deque, everybody else has to steal them
+	void RunFanOut(JobSystem& jobSystem);
+	// ParallelFor with a small grain, thieves steal the lazily split halves
+	void RunParallelFor(JobSystem& jobSystem);
+
+	static const uint32_t NUM_JOBS = 64;
+	static const uint32_t NUM_COUNTER_ROUNDS = 20000;
+
+	static const uint32_t NUM_HANDLE_JOBS = 16384;
+	static const uint32_t NUM_HANDLE_FRAMES = 20;
+
+	static const uint32_t NUM_STEAL_ROUNDS = 50;
+	static const uint32_t NUM_FAN_OUT_JOBS = 2000;
+	static const uint32_t NUM_PARALLEL_FOR_ITEMS = 100000;
+
+	uint32_t mNumThreads;
+};
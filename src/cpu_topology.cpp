@@ -0,0 +1,414 @@
+#include "cpu_topology.h"
+#include "defines.h"
+
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <map>
+#include <set>
+#include <thread>
+
+#ifdef __linux__
+	#include <sched.h>
+#endif
+
+static bool ReadFile(const std::string& path, std::string& content)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		return false;
+	}
+	std::getline(file, content);
+	return true;
+}
+
+// the whole text has to be a number, sysfs files may be empty or hold garbage on odd kernels
+static bool ParseUInt(const std::string& text, uint32_t& value)
+{
+	uint32_t parsed = 0;
+	std::from_chars_result result = std::from_chars(text.data(), text.data() + text.size(), parsed);
+	if (result.ec != std::errc() || result.ptr != text.data() + text.size())
+	{
+		return false;
+	}
+	value = parsed;
+	return true;
+}
+
+// value is left untouched if the file is missing or no number, so it keeps its "unknown" default
+static bool ReadUInt(const std::string& path, uint32_t& value)
+{
+	std::string content;
+	return ReadFile(path, content) && ParseUInt(content, value);
+}
+
+CpuTopology::CpuTopology()
+	: mNumCores{ 0 }, mNumIsolatedCpus{ 0 }
+{
+	DetectFallback();
+}
+
+bool CpuTopology::Detect(const std::string& sysCpuPath, const std::string& sysNodePath)
+{
+#ifdef __linux__
+	std::string content;
+	std::vector<uint32_t> online;
+	if (!ReadFile(sysCpuPath + "/online", content) || !ParseCpuList(content, online) || online.empty())
+	{
+		HTL_LOGW("Could not read online cpus from " << sysCpuPath << ", using flat cpu topology");
+		DetectFallback();
+		return false;
+	}
+
+	std::vector<uint32_t> isolated;
+	if (ReadFile(sysCpuPath + "/isolated", content))
+	{
+		ParseCpuList(content, isolated);
+	}
+
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	bool hasAllowedMask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+	std::vector<LogicalCpu> cpus;
+	std::map<uint32_t, uint32_t> coreIndices;
+	mNumIsolatedCpus = 0;
+	for (uint32_t id : online)
+	{
+		if (std::find(isolated.begin(), isolated.end(), id) != isolated.end())
+		{
+			mNumIsolatedCpus++;
+			continue;
+		}
+		if (hasAllowedMask && id < CPU_SETSIZE && !CPU_ISSET(id, &allowed))
+		{
+			continue;
+		}
+
+		std::string cpuPath = sysCpuPath + "/cpu" + std::to_string(id);
+		LogicalCpu cpu{ id, 0, 0, 0, 0, id, id };
+		ReadUInt(cpuPath + "/topology/physical_package_id", cpu.Package);
+
+		// the lowest sibling identifies the physical core, our position in the list is the SMT index
+		std::vector<uint32_t> siblings;
+		if (ReadFile(cpuPath + "/topology/thread_siblings_list", content) && ParseCpuList(content, siblings) && !siblings.empty())
+		{
+			cpu.SmtIndex = static_cast<uint32_t>(std::find(siblings.begin(), siblings.end(), id) - siblings.begin());
+			auto inserted = coreIndices.insert({ siblings.front(), static_cast<uint32_t>(coreIndices.size()) });
+			cpu.Core = inserted.first->second;
+		}
+		else
+		{
+			auto inserted = coreIndices.insert({ id, static_cast<uint32_t>(coreIndices.size()) });
+			cpu.Core = inserted.first->second;
+		}
+
+		// without an L3 all cpus of a package count as one group
+		cpu.L3Group = UINT32_MAX - cpu.Package;
+		for (uint32_t index = 0; ; index++)
+		{
+			std::string cachePath = cpuPath + "/cache/index" + std::to_string(index);
+			uint32_t level = 0;
+			if (!ReadUInt(cachePath + "/level", level))
+			{
+				break;
+			}
+
+			std::vector<uint32_t> sharedCpus;
+			if (level < 2 || !ReadFile(cachePath + "/shared_cpu_list", content) || !ParseCpuList(content, sharedCpus) || sharedCpus.empty())
+			{
+				continue;
+			}
+			if (level == 2)
+			{
+				cpu.L2Group = sharedCpus.front();
+			}
+			else if (level == 3)
+			{
+				cpu.L3Group = sharedCpus.front();
+			}
+		}
+		cpus.push_back(cpu);
+	}
+
+	if (cpus.empty())
+	{
+		HTL_LOGW("No usable cpus found in " << sysCpuPath << ", using flat cpu topology");
+		DetectFallback();
+		return false;
+	}
+
+	mCpus = cpus;
+	mNumCores = static_cast<uint32_t>(coreIndices.size());
+	DetectNumaNodes(sysNodePath);
+	return true;
+#else
+	(void)sysCpuPath;
+	(void)sysNodePath;
+	DetectFallback();
+	return false;
+#endif
+}
+
+void CpuTopology::DetectFallback()
+{
+	uint32_t numCpus = std::max(std::thread::hardware_concurrency(), 1U);
+	mCpus.clear();
+	for (uint32_t id = 0; id < numCpus; id++)
+	{
+		mCpus.push_back({ id, id, 0, 0, 0, 0, 0 });
+	}
+	mNumaNodes.assign(1, 0);
+	mNumCores = numCpus;
+	mNumIsolatedCpus = 0;
+}
+
+void CpuTopology::DetectNumaNodes(const std::string& sysNodePath)
+{
+	std::string content;
+	std::vector<uint32_t> nodes;
+	if (ReadFile(sysNodePath + "/online", content))
+	{
+		ParseCpuList(content, nodes);
+	}
+
+	for (uint32_t node : nodes)
+	{
+		std::vector<uint32_t> nodeCpus;
+		if (!ReadFile(sysNodePath + "/node" + std::to_string(node) + "/cpulist", content) || !ParseCpuList(content, nodeCpus))
+		{
+			continue;
+		}
+		for (LogicalCpu& cpu : mCpus)
+		{
+			if (std::find(nodeCpus.begin(), nodeCpus.end(), cpu.Id) != nodeCpus.end())
+			{
+				cpu.NumaNode = node;
+			}
+		}
+	}
+
+	// only nodes we actually run on, memory only nodes don't get workers
+	std::set<uint32_t> usedNodes;
+	for (const LogicalCpu& cpu : mCpus)
+	{
+		usedNodes.insert(cpu.NumaNode);
+	}
+	mNumaNodes.assign(usedNodes.begin(), usedNodes.end());
+}
+
+const std::vector<CpuTopology::LogicalCpu>& CpuTopology::GetCpus() const
+{
+	return mCpus;
+}
+
+const CpuTopology::LogicalCpu* CpuTopology::FindCpu(uint32_t id) const
+{
+	for (const LogicalCpu& cpu : mCpus)
+	{
+		if (cpu.Id == id)
+		{
+			return &cpu;
+		}
+	}
+	return nullptr;
+}
+
+uint32_t CpuTopology::GetNumCores() const
+{
+	return mNumCores;
+}
+
+uint32_t CpuTopology::GetNumL3Groups() const
+{
+	std::set<uint32_t> groups;
+	for (const LogicalCpu& cpu : mCpus)
+	{
+		groups.insert(cpu.L3Group);
+	}
+	return static_cast<uint32_t>(groups.size());
+}
+
+const std::vector<uint32_t>& CpuTopology::GetNumaNodes() const
+{
+	return mNumaNodes;
+}
+
+uint32_t CpuTopology::GetNumIsolatedCpus() const
+{
+	return mNumIsolatedCpus;
+}
+
+std::vector<CpuTopology::LogicalCpu> CpuTopology::GetCompactOrder() const
+{
+	// neighbours in this order share as much as possible: node, package, L3, L2 and finally the core itself
+	std::vector<LogicalCpu> cpus = mCpus;
+	std::stable_sort(cpus.begin(), cpus.end(), [](const LogicalCpu& a, const LogicalCpu& b)
+	{
+		if (a.NumaNode != b.NumaNode) return a.NumaNode < b.NumaNode;
+		if (a.Package != b.Package) return a.Package < b.Package;
+		if (a.L3Group != b.L3Group) return a.L3Group < b.L3Group;
+		if (a.L2Group != b.L2Group) return a.L2Group < b.L2Group;
+		if (a.Core != b.Core) return a.Core < b.Core;
+		return a.SmtIndex < b.SmtIndex;
+	});
+	return cpus;
+}
+
+std::vector<uint32_t> CpuTopology::GetPlacement(AffinityPolicy policy) const
+{
+	std::vector<uint32_t> placement;
+	if (policy == AffinityPolicy::None)
+	{
+		return placement;
+	}
+
+	std::vector<LogicalCpu> cpus = GetCompactOrder();
+	if (policy == AffinityPolicy::Compact)
+	{
+		for (const LogicalCpu& cpu : cpus)
+		{
+			placement.push_back(cpu.Id);
+		}
+		return placement;
+	}
+
+	// both remaining policies use every physical core once before any SMT sibling
+	uint32_t maxSmtIndex = 0;
+	for (const LogicalCpu& cpu : cpus)
+	{
+		maxSmtIndex = std::max(maxSmtIndex, cpu.SmtIndex);
+	}
+
+	for (uint32_t smtIndex = 0; smtIndex <= maxSmtIndex; smtIndex++)
+	{
+		if (policy == AffinityPolicy::PhysicalCores)
+		{
+			for (const LogicalCpu& cpu : cpus)
+			{
+				if (cpu.SmtIndex == smtIndex)
+				{
+					placement.push_back(cpu.Id);
+				}
+			}
+			continue;
+		}
+
+		// scatter: one cpu of every L3 group in turn
+		std::vector<std::vector<uint32_t>> groups;
+		std::vector<uint32_t> groupIds;
+		for (const LogicalCpu& cpu : cpus)
+		{
+			if (cpu.SmtIndex != smtIndex)
+			{
+				continue;
+			}
+			auto group = std::find(groupIds.begin(), groupIds.end(), cpu.L3Group);
+			if (group == groupIds.end())
+			{
+				groupIds.push_back(cpu.L3Group);
+				groups.emplace_back();
+				group = groupIds.end() - 1;
+			}
+			groups[group - groupIds.begin()].push_back(cpu.Id);
+		}
+
+		for (size_t round = 0; ; round++)
+		{
+			bool added = false;
+			for (const std::vector<uint32_t>& group : groups)
+			{
+				if (round < group.size())
+				{
+					placement.push_back(group[round]);
+					added = true;
+				}
+			}
+			if (!added)
+			{
+				break;
+			}
+		}
+	}
+	return placement;
+}
+
+void CpuTopology::Print() const
+{
+	HTL_LOG("Cpu topology: " << mCpus.size() << " usable logical cpus, " << mNumCores << " physical cores, "
+		<< GetNumL3Groups() << " L3 groups, " << mNumaNodes.size() << " NUMA nodes, " << mNumIsolatedCpus << " isolated cpus");
+	for ([[maybe_unused]] const LogicalCpu& cpu : mCpus)
+	{
+		HTL_LOGD("cpu " << cpu.Id << ": core " << cpu.Core << " (smt " << cpu.SmtIndex << "), package " << cpu.Package << ", node " << cpu.NumaNode
+			<< ", L2 group " << cpu.L2Group << ", L3 group " << cpu.L3Group);
+	}
+}
+
+const char* CpuTopology::ToString(AffinityPolicy policy)
+{
+	switch (policy)
+	{
+	case AffinityPolicy::None: return "none";
+	case AffinityPolicy::Compact: return "compact";
+	case AffinityPolicy::Scatter: return "scatter";
+	case AffinityPolicy::PhysicalCores: return "cores";
+	}
+	return "unknown";
+}
+
+bool CpuTopology::ParseAffinityPolicy(const std::string& name, AffinityPolicy& policy)
+{
+	for (AffinityPolicy candidate : { AffinityPolicy::None, AffinityPolicy::Compact, AffinityPolicy::Scatter, AffinityPolicy::PhysicalCores })
+	{
+		if (name == ToString(candidate))
+		{
+			policy = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+// kernels support a few thousand cpus at most, a bigger id means a broken file
+static const uint32_t MAX_CPU_ID = 65535;
+
+bool CpuTopology::ParseCpuList(const std::string& text, std::vector<uint32_t>& cpus)
+{
+	size_t position = 0;
+	while (position < text.size())
+	{
+		size_t end = text.find(',', position);
+		if (end == std::string::npos)
+		{
+			end = text.size();
+		}
+
+		std::string range = text.substr(position, end - position);
+		position = end + 1;
+		if (range.empty() || range == "\n")
+		{
+			continue;
+		}
+
+		if (range.back() == '\n')
+		{
+			range.pop_back();
+		}
+		size_t dash = range.find('-');
+		uint32_t first = 0;
+		uint32_t last = 0;
+		// the limit also keeps the loop below from wrapping around at UINT32_MAX
+		if (!ParseUInt(range.substr(0, dash), first) || !ParseUInt(dash == std::string::npos ? range : range.substr(dash + 1), last)
+			|| first > last || last > MAX_CPU_ID)
+		{
+			HTL_LOGE("Invalid cpu list: " << text);
+			return false;
+		}
+		for (uint32_t id = first; id <= last; id++)
+		{
+			cpus.push_back(id);
+		}
+	}
+	return true;
+}
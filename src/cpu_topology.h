@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// general information
+// ===================
+// - Model of the logical cpus the job system may run on, read from /sys/devices/system/cpu on Linux
+// - Knows which logical cpus are SMT siblings of the same physical core and which share an L2 or L3 cache
+// - NUMA nodes come from /sys/devices/system/node, without them every cpu is on node 0
+// - Only usable cpus are part of the model: online, in the affinity mask of the process and not isolated
+//      (isolated cpus are reserved by the admin with isolcpus=, the scheduler keeps everything else away)
+// - Other platforms and missing sysfs fall back to a flat model: every logical cpu is its own core
+// - GetPlacement() returns the order in which workers get pinned to cpus:
+//      Compact         fill SMT siblings first, then cores sharing a cache, workers share caches as much as possible
+//      Scatter         round robin over L3 groups, one thread per core first, spreads cache and memory bandwidth
+//      PhysicalCores   one worker per physical core in compact order, SMT siblings only if there are more workers
+
+enum class AffinityPolicy
+{
+	None,
+	Compact,
+	Scatter,
+	PhysicalCores
+};
+
+class CpuTopology
+{
+public:
+	struct LogicalCpu
+	{
+		uint32_t Id;
+		// index of the physical core, SMT siblings share it
+		uint32_t Core;
+		// 0 for the first hardware thread of a core, 1 for its first sibling, ...
+		uint32_t SmtIndex;
+		uint32_t Package;
+		uint32_t NumaNode;
+		// lowest cpu id sharing the cache, so cpus with the same group share the cache
+		uint32_t L2Group;
+		uint32_t L3Group;
+	};
+
+	CpuTopology();
+
+	// returns false if the topology couldn't be read, the flat fallback model is used then
+	bool Detect(const std::string& sysCpuPath = "/sys/devices/system/cpu", const std::string& sysNodePath = "/sys/devices/system/node");
+
+	const std::vector<LogicalCpu>& GetCpus() const;
+	const LogicalCpu* FindCpu(uint32_t id) const;
+	uint32_t GetNumCores() const;
+	uint32_t GetNumL3Groups() const;
+	// ids of the nodes with usable cpus, ascending
+	const std::vector<uint32_t>& GetNumaNodes() const;
+	uint32_t GetNumIsolatedCpus() const;
+
+	// cpu ids in the order workers get pinned to, empty for AffinityPolicy::None
+	std::vector<uint32_t> GetPlacement(AffinityPolicy policy) const;
+
+	void Print() const;
+
+	static const char* ToString(AffinityPolicy policy);
+	static bool ParseAffinityPolicy(const std::string& name, AffinityPolicy& policy);
+
+	// parses the kernel's cpu list format, e.g. "0-3,8,10-11"
+	static bool ParseCpuList(const std::string& text, std::vector<uint32_t>& cpus);
+
+private:
+	void DetectFallback();
+	void DetectNumaNodes(const std::string& sysNodePath);
+	std::vector<LogicalCpu> GetCompactOrder() const;
+
+	std::vector<LogicalCpu> mCpus;
+	std::vector<uint32_t> mNumaNodes;
+	uint32_t mNumCores;
+	uint32_t mNumIsolatedCpus;
+};
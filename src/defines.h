@@ -6,16 +6,22 @@
 #define HTL_USING_LOCKLESS // using lockless variant of worker queue
 //#define HTL_EXTRA_LOCKS // still using locks in lockless queue for testing
 #define HTL_TEST_DEPENDENCIES // test if correct dependencies are met
-#define HTL_WAIT_FOR_AVAILABLE_JOBS // if set, conditional var wakes on executable jobs instead of size > 0
 //#define HTL_TEST_ONLY_ONE_FRAME // main loop returns after one execution
 //#define HTL_EXTRA_DEBUG // additional debug output
-//#define HTL_SORT_JOBS // sort jobs to be allow workers to instantly start after pushing
+//#define HTL_JOB_NAMES // keep job names also without extra debug output
+#define HTL_JOB_STATS // record execution times per kind of job, see job_stats.h
+//#define HTL_FIBERS // workers run jobs on fibers, a waiting job parks its fiber instead of blocking the worker, see fiber.h
 
 // if compiling for debug mode enable additional output explicitly
 #ifdef _DEBUG
     #define HTL_EXTRA_DEBUG
 #endif
 
+// job names live in the cold part of a job and are only kept for debugging, the job stats don't need them
+#if defined(HTL_EXTRA_DEBUG) && !defined(HTL_JOB_NAMES)
+    #define HTL_JOB_NAMES
+#endif
+
 #define HTL_LOGE(message) ThreadSafeLogger::Logger << "\x1B[31m[ERROR]  " << message << "\033[0m\n"
 #define HTL_LOGW(message) ThreadSafeLogger::Logger << "\x1B[33m[WARNING]" << message << "\033[0m\n"
 #if defined(HTL_EXTRA_DEBUG)
@@ -34,3 +40,17 @@
 #else
     #define HTL_LOGT(threadId, message)
 #endif
+
+
+// hint for the cpu that we are busy waiting, so it can save power and give the sibling hyper thread more resources
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    #include <intrin.h>
+    #define HTL_CPU_PAUSE() _mm_pause()
+#elif defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define HTL_CPU_PAUSE() _mm_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+    #define HTL_CPU_PAUSE() __asm__ __volatile__("yield")
+#else
+    #define HTL_CPU_PAUSE() std::this_thread::yield()
+#endif
@@ -0,0 +1,80 @@
+#pragma once
+
+// general information
+// ===================
+// - Event count for parking threads on std::atomic::wait / notify (a futex on Linux, WaitOnAddress on Windows)
+// - Waiting is split in two steps, so no wakeup can get lost between checking for work and sleeping:
+//      EventCount::Key key = eventCount.PrepareWait();
+//      if (hasWork) eventCount.CancelWait();
+//      else eventCount.Wait(key);
+// - Notify only bumps the epoch and calls into the kernel if somebody announced waiting,
+//      so producers pay one fence and one load while all waiters are awake
+// - A notification between PrepareWait and Wait changes the epoch, so Wait returns right away
+
+#include <atomic>
+#include <cstdint>
+
+class EventCount
+{
+public:
+    typedef uint32_t Key;
+
+    EventCount() = default;
+
+    EventCount(const EventCount&) = delete;
+    EventCount& operator=(const EventCount&) = delete;
+
+    Key PrepareWait()
+    {
+        mNumWaiters.fetch_add(1, std::memory_order_relaxed);
+        // pairs with the fence in Notify: either the waiter sees the new work or the notifier sees the waiter
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return mEpoch.load(std::memory_order_acquire);
+    }
+
+    void CancelWait()
+    {
+        mNumWaiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // returns once the epoch moved on from key, spurious wakeups are filtered by std::atomic::wait
+    void Wait(Key key)
+    {
+        mEpoch.wait(key, std::memory_order_acquire);
+        mNumWaiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // both return false without a syscall if nobody is waiting
+    bool NotifyOne()
+    {
+        if (!PrepareNotify()) return false;
+        mEpoch.notify_one();
+        return true;
+    }
+
+    bool NotifyAll()
+    {
+        if (!PrepareNotify()) return false;
+        mEpoch.notify_all();
+        return true;
+    }
+
+    // only a snapshot, use it to skip notifying, the notify functions check again
+    bool HasWaiters() const
+    {
+        return mNumWaiters.load(std::memory_order_relaxed) > 0;
+    }
+
+private:
+    bool PrepareNotify()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (mNumWaiters.load(std::memory_order_relaxed) == 0) return false;
+
+        mEpoch.fetch_add(1, std::memory_order_release);
+        return true;
+    }
+
+    std::atomic<Key> mEpoch{ 0 };
+    std::atomic<uint32_t> mNumWaiters{ 0 };
+};
@@ -0,0 +1,236 @@
+#include "fiber.h"
+#include "defines.h"
+
+#include <cstdlib>
+
+#if defined(_WIN32)
+	#include <Windows.h>
+#else
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif
+
+#if defined(HTL_FIBER_ASM)
+// System V calling convention: rbx, rbp, r12-r15 and the sse/x87 control words survive a call,
+// everything else is already saved by the caller of Switch
+extern "C" void HtlSwitchFiberContext(void** fromStackPointer, void* toStackPointer);
+// first return address of a new fiber, calls the function in r12 with the fiber in rbx
+extern "C" void HtlStartFiberContext();
+
+asm(R"(
+	.pushsection .text
+	.globl HtlSwitchFiberContext
+	.hidden HtlSwitchFiberContext
+	.type HtlSwitchFiberContext, @function
+HtlSwitchFiberContext:
+	pushq %rbp
+	pushq %rbx
+	pushq %r12
+	pushq %r13
+	pushq %r14
+	pushq %r15
+	subq $8, %rsp
+	stmxcsr (%rsp)
+	fnstcw 4(%rsp)
+	movq %rsp, (%rdi)
+	movq %rsi, %rsp
+	ldmxcsr (%rsp)
+	fldcw 4(%rsp)
+	addq $8, %rsp
+	popq %r15
+	popq %r14
+	popq %r13
+	popq %r12
+	popq %rbx
+	popq %rbp
+	ret
+	.size HtlSwitchFiberContext, .-HtlSwitchFiberContext
+
+	.globl HtlStartFiberContext
+	.hidden HtlStartFiberContext
+	.type HtlStartFiberContext, @function
+HtlStartFiberContext:
+	movq %rbx, %rdi
+	call *%r12
+	ud2
+	.size HtlStartFiberContext, .-HtlStartFiberContext
+	.popsection
+)");
+#endif
+
+Fiber::Fiber()
+{
+#if defined(_WIN32)
+	mIsThread = true;
+	mHandle = ConvertThreadToFiberEx(nullptr, FIBER_FLAG_FLOAT_SWITCH);
+	if (mHandle == nullptr)
+	{
+		// already a fiber, e.g. converted by someone else
+		mHandle = GetCurrentFiber();
+		mIsThread = false;
+	}
+#endif
+}
+
+Fiber::Fiber(size_t stackSize, EntryFunction entry)
+	: mEntry(entry)
+	, mStackSize(stackSize)
+{
+#if defined(_WIN32)
+	mHandle = CreateFiberEx(0, stackSize, FIBER_FLAG_FLOAT_SWITCH, [](void* fiber) { Start(static_cast<Fiber*>(fiber)); }, this);
+	if (mHandle == nullptr)
+	{
+		HTL_LOGE("CreateFiberEx failed, GLE=" << GetLastError());
+	}
+#else
+	// whole pages, the one below the stack stays inaccessible, so an overflow crashes instead of corrupting a neighbour
+	size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	mStackSize = (stackSize + pageSize - 1) / pageSize * pageSize;
+	mGuardSize = pageSize;
+	void* memory = mmap(nullptr, mGuardSize + mStackSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED)
+	{
+		HTL_LOGE("Could not allocate a fiber stack of " << mStackSize << " bytes");
+		mStackSize = 0;
+		return;
+	}
+	mStack = static_cast<unsigned char*>(memory);
+	mprotect(mStack, mGuardSize, PROT_NONE);
+
+	#if defined(HTL_FIBER_ASM)
+	// the stack as HtlSwitchFiberContext leaves it, so the first switch "returns" into HtlStartFiberContext
+	// with a 16 byte aligned stack pointer, like right before a call
+	uintptr_t top = reinterpret_cast<uintptr_t>(mStack + mGuardSize + mStackSize) & ~uintptr_t(15);
+	void** frame = reinterpret_cast<void**>(top - 16);
+	frame[-1] = reinterpret_cast<void*>(&HtlStartFiberContext);
+	frame[-2] = nullptr;                                     // rbp
+	frame[-3] = this;                                        // rbx
+	frame[-4] = reinterpret_cast<void*>(&Fiber::Start);      // r12
+	frame[-5] = nullptr;                                     // r13
+	frame[-6] = nullptr;                                     // r14
+	frame[-7] = nullptr;                                     // r15
+	// default mxcsr (all exceptions masked, round to nearest) and x87 control word
+	uint32_t* controlWords = reinterpret_cast<uint32_t*>(&frame[-8]);
+	controlWords[0] = 0x1F80;
+	controlWords[1] = 0x037F;
+	mStackPointer = &frame[-8];
+	#else
+	getcontext(&mContext);
+	mContext.uc_stack.ss_sp = mStack + mGuardSize;
+	mContext.uc_stack.ss_size = mStackSize;
+	mContext.uc_link = nullptr;
+	// makecontext only passes ints
+	uintptr_t self = reinterpret_cast<uintptr_t>(this);
+	makecontext(&mContext, reinterpret_cast<void (*)()>(&Fiber::StartContext), 2, static_cast<uint32_t>(self), static_cast<uint32_t>(uint64_t(self) >> 32));
+	#endif
+#endif
+}
+
+Fiber::~Fiber()
+{
+#if defined(_WIN32)
+	if (mIsThread)
+	{
+		ConvertFiberToThread();
+	}
+	else if (mEntry != nullptr && mHandle != nullptr)
+	{
+		DeleteFiber(mHandle);
+	}
+#else
+	if (mStack != nullptr)
+	{
+		munmap(mStack, mGuardSize + mStackSize);
+	}
+#endif
+}
+
+void Fiber::Switch(Fiber& from, Fiber& to)
+{
+#if defined(_WIN32)
+	(void)from;
+	SwitchToFiber(to.mHandle);
+#elif defined(HTL_FIBER_ASM)
+	HtlSwitchFiberContext(&from.mStackPointer, to.mStackPointer);
+#else
+	swapcontext(&from.mContext, &to.mContext);
+#endif
+}
+
+bool Fiber::IsValid() const
+{
+#if defined(_WIN32)
+	return mHandle != nullptr;
+#else
+	return mEntry == nullptr || mStack != nullptr;
+#endif
+}
+
+size_t Fiber::GetStackSize() const
+{
+	return mStackSize;
+}
+
+void Fiber::Start(Fiber* fiber)
+{
+	fiber->mEntry(fiber);
+	// there is no context to return to
+	HTL_LOGE("Fiber entry returned");
+	std::abort();
+}
+
+#if !defined(_WIN32) && !defined(HTL_FIBER_ASM)
+void Fiber::StartContext(uint32_t low, uint32_t high)
+{
+	Start(reinterpret_cast<Fiber*>(static_cast<uintptr_t>((uint64_t(high) << 32) | low)));
+}
+#endif
+
+FiberPool::FiberPool(uint32_t numFibers, size_t stackSize, Fiber::EntryFunction entry)
+{
+	mFibers.reserve(numFibers);
+	mFreeFibers.reserve(numFibers);
+	for (uint32_t i = 0; i < numFibers; i++)
+	{
+		std::unique_ptr<Fiber> fiber(new Fiber(stackSize, entry));
+		if (!fiber->IsValid())
+		{
+			break;
+		}
+#if USE_OPTICK
+		Optick::RegisterFiber(i, &fiber->OptickStorage);
+#endif
+		mFreeFibers.push_back(fiber.get());
+		mFibers.push_back(std::move(fiber));
+	}
+	HTL_LOGD("Created " << mFibers.size() << " fibers with " << stackSize / 1024 << "KB stacks");
+}
+
+Fiber* FiberPool::Acquire()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (mFreeFibers.empty())
+	{
+		return nullptr;
+	}
+	Fiber* fiber = mFreeFibers.back();
+	mFreeFibers.pop_back();
+	return fiber;
+}
+
+void FiberPool::Release(Fiber* fiber)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mFreeFibers.push_back(fiber);
+}
+
+uint32_t FiberPool::GetNumFibers() const
+{
+	return static_cast<uint32_t>(mFibers.size());
+}
+
+uint32_t FiberPool::GetNumFreeFibers() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return static_cast<uint32_t>(mFreeFibers.size());
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "../optick/src/optick.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if defined(_WIN32)
+	// Windows fibers, CreateFiberEx reserves the stack
+#elif defined(__x86_64__) && defined(__linux__)
+	// hand-written switch, only the callee saved registers are stored on the fiber's own stack
+	#define HTL_FIBER_ASM
+#else
+	#include <ucontext.h>
+#endif
+
+// general information
+// ===================
+// - A fiber is a stack plus the registers to continue on it, switching between fibers of one thread
+//      is a function call that returns on another stack, no kernel involved
+// - With HTL_FIBERS every worker runs its job loop on a pooled fiber. A job that waits for another job
+//      parks its fiber instead of blocking the worker, which goes on with a fresh fiber, see JobSystem::WaitFor
+// - Fibers never switch to each other directly, the worker thread's own context (the scheduler) picks
+//      the next one, so switching out is always a switch back to the scheduler
+// - Stacks have a fixed size with a guard page below, code that runs on fibers must not put big arrays on the stack
+// - Thread locals are cached by the compiler across calls, so a fiber has to continue on the thread that parked it
+
+class Fiber
+{
+public:
+	typedef void (*EntryFunction)(Fiber* fiber);
+
+	// wraps the calling thread, so it can switch to fibers and they can switch back to it
+	Fiber();
+	// runs entry on an own stack the first time it is switched to, entry must never return
+	Fiber(size_t stackSize, EntryFunction entry);
+	~Fiber();
+
+	Fiber(const Fiber&) = delete;
+	Fiber& operator=(const Fiber&) = delete;
+
+	// saves the running context in from and continues to, returns once something switches back to from
+	// from has to be the fiber (or thread) running right now
+	static void Switch(Fiber& from, Fiber& to);
+
+	// false if the stack couldn't be allocated
+	bool IsValid() const;
+	size_t GetStackSize() const;
+
+	// free for the one running the fiber, e.g. the worker whose job loop runs on it
+	void* UserData{ nullptr };
+	// intrusive link, so lists of fibers don't allocate
+	Fiber* Next{ nullptr };
+
+#if USE_OPTICK
+	// events of jobs on this fiber are recorded here, the running thread swaps it in, see JobWorker::SwitchToFiber
+	Optick::EventStorage* OptickStorage{ nullptr };
+#endif
+
+private:
+	static void Start(Fiber* fiber);
+
+	EntryFunction mEntry{ nullptr };
+	size_t mStackSize{ 0 };
+
+#if defined(_WIN32)
+	void* mHandle{ nullptr };
+	bool mIsThread{ false };
+#else
+	// lowest address including the guard page, nullptr for a thread
+	unsigned char* mStack{ nullptr };
+	size_t mGuardSize{ 0 };
+	#if defined(HTL_FIBER_ASM)
+	void* mStackPointer{ nullptr };
+	#else
+	ucontext_t mContext;
+	static void StartContext(uint32_t low, uint32_t high);
+	#endif
+#endif
+};
+
+// fixed number of fibers with fixed-size stacks, all allocated up front, so parking a job never allocates
+// only used when a job parks or a worker picks its next fiber, so a mutex is cheap enough
+class FiberPool
+{
+public:
+	FiberPool(uint32_t numFibers, size_t stackSize, Fiber::EntryFunction entry);
+
+	FiberPool(const FiberPool&) = delete;
+	FiberPool& operator=(const FiberPool&) = delete;
+
+	// nullptr if all fibers are in use, may be called from any thread
+	Fiber* Acquire();
+	void Release(Fiber* fiber);
+
+	uint32_t GetNumFibers() const;
+	// only a snapshot
+	uint32_t GetNumFreeFibers() const;
+
+private:
+	std::vector<std::unique_ptr<Fiber>> mFibers;
+	std::vector<Fiber*> mFreeFibers;
+	mutable std::mutex mMutex;
+};
@@ -0,0 +1,89 @@
+#include "idle_policy.h"
+
+#include <algorithm>
+
+IdlePolicy::Action IdlePolicy::Next(const IdleSettings& settings)
+{
+	if (mIdleIterations == 0)
+	{
+		mIdleStart = Clock::now();
+		if (!settings.Adaptive || mSpinBudget == 0)
+		{
+			mSpinBudget = settings.SpinIterations;
+		}
+	}
+
+	uint32_t iteration = mIdleIterations++;
+	if (iteration < mSpinBudget)
+	{
+		return Action::Spin;
+	}
+	if (iteration == mSpinBudget && mSpinBudget > 0)
+	{
+		// spinning is over, a good moment to learn how long one spin takes
+		UpdateNanosecondsPerSpin(GetIdleNanoseconds(), mSpinBudget);
+	}
+	if (iteration < mSpinBudget + settings.YieldIterations)
+	{
+		return Action::Yield;
+	}
+	return Action::Park;
+}
+
+void IdlePolicy::OnWork(const IdleSettings& settings)
+{
+	if (mIdleIterations == 0)
+	{
+		// worker was busy, nothing to learn
+		return;
+	}
+
+	uint32_t idleIterations = mIdleIterations;
+	mIdleIterations = 0;
+	if (!settings.Adaptive)
+	{
+		return;
+	}
+
+	int64_t gap = GetIdleNanoseconds();
+	if (idleIterations <= mSpinBudget)
+	{
+		UpdateNanosecondsPerSpin(gap, idleIterations);
+	}
+	if (mNanosecondsPerSpin == 0)
+	{
+		return;
+	}
+
+	// long gaps only count as "too long to spin", so one long frame gap doesn't dominate the average
+	int64_t maxSpinNanoseconds = static_cast<int64_t>(settings.SpinIterations) * mNanosecondsPerSpin;
+	gap = std::min(gap, 2 * maxSpinNanoseconds);
+	mAverageGapNanoseconds = mAverageGapNanoseconds == 0 ? gap : mAverageGapNanoseconds + (gap - mAverageGapNanoseconds) / 8;
+
+	int64_t budget = MIN_SPIN_ITERATIONS;
+	if (mAverageGapNanoseconds <= maxSpinNanoseconds)
+	{
+		budget = 2 * mAverageGapNanoseconds / mNanosecondsPerSpin;
+	}
+	mSpinBudget = static_cast<uint32_t>(std::min<int64_t>(std::max<int64_t>(budget, MIN_SPIN_ITERATIONS), settings.SpinIterations));
+}
+
+uint32_t IdlePolicy::GetSpinBudget() const
+{
+	return mSpinBudget;
+}
+
+int64_t IdlePolicy::GetIdleNanoseconds() const
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - mIdleStart).count();
+}
+
+void IdlePolicy::UpdateNanosecondsPerSpin(int64_t idleNanoseconds, uint32_t spinIterations)
+{
+	if (spinIterations == 0)
+	{
+		return;
+	}
+	int64_t nanosecondsPerSpin = std::max<int64_t>(idleNanoseconds / spinIterations, 1);
+	mNanosecondsPerSpin = mNanosecondsPerSpin == 0 ? nanosecondsPerSpin : mNanosecondsPerSpin + (nanosecondsPerSpin - mNanosecondsPerSpin) / 8;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// general information
+// ===================
+// - Decides what an idle worker does next: spin with a pause instruction, then yield, then park
+// - Gaps between dependent jobs are often shorter than sleeping and waking up again,
+//      so spinning a bit catches them without the wake up latency of the event count
+// - With Adaptive the spin budget follows the observed gaps between two jobs of the worker:
+//      about twice the average gap if spinning can catch it, otherwise only a minimal spin
+//      because sleeping is cheaper than burning the core until the next job arrives
+// - Time is only taken when the worker gets idle and when it finds work again, never while busy
+
+struct IdleSettings
+{
+	// spin budget, upper bound for the adaptive budget
+	uint32_t SpinIterations{ 4096 };
+	// yields after spinning before the worker parks
+	uint32_t YieldIterations{ 16 };
+	bool Adaptive{ true };
+};
+
+class IdlePolicy
+{
+public:
+	enum class Action
+	{
+		Spin,
+		Yield,
+		Park
+	};
+
+	// called when no job was found, returns what to do before looking again
+	Action Next(const IdleSettings& settings);
+
+	// called when a job was found, adapts the spin budget if the worker was idle before
+	void OnWork(const IdleSettings& settings);
+
+	uint32_t GetSpinBudget() const;
+
+private:
+	typedef std::chrono::high_resolution_clock Clock;
+
+	// always spin at least a little, a dependant is often ready right after its dependency finished
+	static const uint32_t MIN_SPIN_ITERATIONS = 32;
+
+	int64_t GetIdleNanoseconds() const;
+	void UpdateNanosecondsPerSpin(int64_t idleNanoseconds, uint32_t spinIterations);
+
+	uint32_t mIdleIterations{ 0 };
+	uint32_t mSpinBudget{ 0 };
+	Clock::time_point mIdleStart;
+
+	// moving averages, 0 until measured
+	int64_t mAverageGapNanoseconds{ 0 };
+	int64_t mNanosecondsPerSpin{ 0 };
+};
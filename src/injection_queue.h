@@ -0,0 +1,150 @@
+#pragma once
+
+// general information
+// ===================
+// - Bounded lock free multi producer / multi consumer queue (Dmitry Vyukov's MPMC queue)
+// - Used as global injection queue: any thread may submit jobs here, idle workers drain it in batches
+//      into their own deques, so only the owner ever touches the private end of a worker deque
+// - Every cell carries a sequence number telling producers and consumers whose turn it is,
+//      so enqueue and dequeue only need one CAS on their own position counter
+//      cell.Sequence == pos      -> free, producer with ticket pos may write
+//      cell.Sequence == pos + 1  -> filled, consumer with ticket pos may read
+// - Capacity has to be a power of two so wrapping is just a mask
+
+#include "job.h"
+
+class InjectionQueue
+{
+private:
+    struct Cell
+    {
+        std::atomic<size_t> Sequence;
+        Job* Entry;
+    };
+
+    Cell* mCells;
+    const size_t mMask;
+
+    // producers and consumers on their own cache lines
+    alignas(64) std::atomic<size_t> mEnqueuePos{ 0 };
+    alignas(64) std::atomic<size_t> mDequeuePos{ 0 };
+
+public:
+    explicit InjectionQueue(size_t capacity)
+        : mCells(new Cell[capacity])
+        , mMask(capacity - 1)
+    {
+        for (size_t i = 0; i < capacity; ++i)
+        {
+            mCells[i].Sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~InjectionQueue()
+    {
+        delete[] mCells;
+    }
+
+    InjectionQueue(const InjectionQueue&) = delete;
+    InjectionQueue& operator=(const InjectionQueue&) = delete;
+
+    // returns false if the queue is full
+    bool Push(Job* job)
+    {
+        Cell* cell;
+        size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            cell = &mCells[pos & mMask];
+            size_t sequence = cell->Sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0)
+            {
+                // cell is free, try to get the ticket
+                if (mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                // consumers didn't free this cell yet -> full
+                return false;
+            }
+            else
+            {
+                // another producer was faster
+                pos = mEnqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->Entry = job;
+        cell->Sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // returns nullptr if the queue is empty
+    Job* Pop()
+    {
+        Cell* cell;
+        size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            cell = &mCells[pos & mMask];
+            size_t sequence = cell->Sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0)
+            {
+                // cell is filled, try to get the ticket
+                if (mDequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                // producer didn't fill this cell yet -> empty
+                return nullptr;
+            }
+            else
+            {
+                // another consumer was faster
+                pos = mDequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        Job* job = cell->Entry;
+        // free the cell for the producer one lap ahead
+        cell->Sequence.store(pos + mMask + 1, std::memory_order_release);
+        return job;
+    }
+
+    // pop up to maxCount jobs at once, returns number of popped jobs
+    size_t PopBatch(Job** jobs, size_t maxCount)
+    {
+        size_t count = 0;
+        while (count < maxCount)
+        {
+            Job* job = Pop();
+            if (job == nullptr)
+            {
+                break;
+            }
+            jobs[count++] = job;
+        }
+        return count;
+    }
+
+    // only a snapshot, may already be outdated when returning
+    size_t Size() const
+    {
+        size_t enqueuePos = mEnqueuePos.load(std::memory_order_relaxed);
+        size_t dequeuePos = mDequeuePos.load(std::memory_order_relaxed);
+        return enqueuePos > dequeuePos ? enqueuePos - dequeuePos : 0;
+    }
+
+    bool Empty() const
+    {
+        return Size() == 0;
+    }
+};
@@ -1,21 +1,46 @@
 #include "job.h"
+#include "job_counter.h"
+#include "job_system.h"
 #include "defines.h"
 
-Job::Job(JobFunc job, std::string name)
-	: mJobFunction{ job }, mName{ name }
+#include <chrono>
+
+static_assert(sizeof(std::atomic_int_fast32_t) + sizeof(JobFunction) <= 64, "hot block of a job has to fit into one cache line");
+
+// marks the continuation list of a finished job
+static JobContinuation sFinishedContinuations{ nullptr, nullptr };
+
+// priority of the job executing on this thread, nested jobs (WaitFor helping) restore it when they return
+static thread_local JobPriority sCurrentPriority{ JobPriority::Normal };
+static thread_local Job* sCurrentJob{ nullptr };
+// set by a job that suspends itself, consumed as soon as its function returned
+static thread_local bool sSuspendCurrentJob{ false };
+
+Job::Job(const JobFunction& job, const char* name, JobPriority priority)
+	: mJobFunction{ job }, mDependants{ nullptr }, mNumDependants{ 0 }, mPriority{ priority }
+#ifdef HTL_JOB_NAMES
+	, mName{ name }
+#endif
 {
+	(void)name;
 }
 
 // allow to specify other jobs that define the dependencies
 // by only providing dependencies in ctor and not public method,
 // we prevent creating circular dependencies
-Job::Job(JobFunc job, std::string name, std::vector<Job*> dependants)
-	: mJobFunction{ job }, mName{ name }, mDependants{ dependants }
+Job::Job(const JobFunction& job, const char* name, Job* const* dependants, uint32_t numDependants, JobPriority priority)
+	: mJobFunction{ job }, mDependants{ dependants }, mNumDependants{ numDependants }, mPriority{ priority }
+#ifdef HTL_JOB_NAMES
+	, mName{ name }
+#endif
 {
-	for (auto dependant : mDependants)
+	(void)name;
+	for (uint32_t i = 0; i < mNumDependants; i++)
 	{
+		Job* dependant = mDependants[i];
 		dependant->mUnfinishedJobs++;
-		HTL_LOGI("Increment dependency on: " << dependant->mName << " by: " << mName << ", unfinishedJobs: " << dependant->mUnfinishedJobs.load());
+		dependant->mNumDependencies++;
+		HTL_LOGI("Increment dependency on: " << dependant->GetName() << " by: " << GetName() << ", unfinishedJobs: " << dependant->mUnfinishedJobs.load());
 	}
 }
 
@@ -25,10 +50,32 @@ bool Job::CanExecute() const
 	return (mUnfinishedJobs.load() == 1);
 }
 
-void Job::Execute()
+Job* Job::Execute(JobSystem& jobSystem)
 {
+	JobPriority outerPriority = sCurrentPriority;
+	Job* outerJob = sCurrentJob;
+	sCurrentPriority = mPriority;
+	sCurrentJob = this;
+#ifdef HTL_JOB_STATS
+	// a suspended job may already run again on another worker when its function returns, so don't read it afterwards
+	const void* key = mJobFunction.GetKey();
+	auto start = std::chrono::high_resolution_clock::now();
+	mJobFunction();
+	auto duration = std::chrono::high_resolution_clock::now() - start;
+	jobSystem.GetJobStats().Record(key, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count()));
+#else
 	mJobFunction();
-	Finish();
+#endif
+	sCurrentPriority = outerPriority;
+	sCurrentJob = outerJob;
+
+	if (sSuspendCurrentJob)
+	{
+		// whatever the job waits for schedules it again
+		sSuspendCurrentJob = false;
+		return nullptr;
+	}
+	return Finish(jobSystem);
 }
 
 bool Job::IsFinished() const
@@ -37,7 +84,93 @@ bool Job::IsFinished() const
 	return (mUnfinishedJobs.load() <= 0);
 }
 
-void Job::Finish()
+Job* Job::Finish(JobSystem& jobSystem)
+{
+	// mark this job as finished first and only work with what we read before afterwards:
+	// once a dependant finished, nothing stops anyone from resetting the jobs anymore (ResetJobs and resubmitting
+	// a graph require all jobs to be finished), and a dependant with other open dependencies may finish any time.
+	// Everything read here stays valid until the last dependant was resolved, because that one can't finish before
+	const char* name = GetName();
+	Job* const* dependants = mDependants;
+	uint32_t numDependants = mNumDependants;
+	JobCounter* counter = mCounter;
+	// close the list, a continuation attached from now on doesn't wait for us anymore
+	JobContinuation* link = mContinuations.exchange(&sFinishedContinuations, std::memory_order_acq_rel);
+
+	int_fast32_t unfinishedJobs = (mUnfinishedJobs.fetch_sub(1) - 1);
+	HTL_LOGI("Job " << name << " finished with open dependecies: " << unfinishedJobs << " on thread #" << std::this_thread::get_id() << "...");
+	if (unfinishedJobs != 0)
+	{
+		HTL_LOGE("Job " << name << " not finished after execution :-o open unfinishedJobs: " << unfinishedJobs);
+	}
+
+	// we resolved the last dependency of a ready dependant, so it only now enters a queue
+	// the first one is handed back to run on this thread without touching any queue,
+	// every further one goes to the own deque (or the injection queue) and wakes a sleeper
+	Job* next = nullptr;
+	auto resolve = [&next, &jobSystem](Job* dependant)
+	{
+		if (dependant->ResolveDependency())
+		{
+			if (next == nullptr)
+			{
+				next = dependant;
+			}
+			else
+			{
+				jobSystem.Schedule(dependant);
+			}
+		}
+	};
+
+	for (uint32_t i = 0; i < numDependants; i++)
+	{
+		resolve(dependants[i]);
+	}
+
+	while (link != nullptr)
+	{
+		// the link may be gone as soon as its dependant runs
+		Job* dependant = link->Dependant;
+		link = link->Next;
+		resolve(dependant);
+	}
+
+	// the counter last, a waiter may reset the jobs or destroy the counter once it reached its target
+	if (counter != nullptr)
+	{
+		JobCounterWaiter* waiter = counter->Decrement();
+		while (waiter != nullptr)
+		{
+			Job* dependant = waiter->Dependant;
+			waiter = waiter->Next;
+			resolve(dependant);
+		}
+	}
+	return next;
+}
+
+bool Job::AddContinuation(JobContinuation* link)
+{
+	JobContinuation* head = mContinuations.load(std::memory_order_acquire);
+	do
+	{
+		if (head == &sFinishedContinuations)
+		{
+			return false;
+		}
+		link->Next = head;
+	} while (!mContinuations.compare_exchange_weak(head, link, std::memory_order_acq_rel, std::memory_order_acquire));
+	return true;
+}
+
+void Job::AddDependency()
+{
+	mUnfinishedJobs++;
+	mNumDependencies++;
+}
+
+bool Job::ResolveDependency()
 {
 	// atomics override pre and postfix to execute in one instruction
 	// https://en.cppreference.com/w/cpp/atomic/atomic/operator_arith
@@ -45,21 +178,23 @@ void Job::Finish()
 	// still, between decrementing and reading the state could be changes by another worker
 	// so creating and using only a local variable
 	int_fast32_t unfinishedJobs = (mUnfinishedJobs.fetch_sub(1) - 1);
-	HTL_LOGI("Job " << mName << " finished with open dependecies: " << unfinishedJobs << " on thread #" << std::this_thread::get_id() << "...");
+	HTL_LOGI("Resolved dependency of " << GetName() << ", now open dependecies: " << unfinishedJobs);
+	return unfinishedJobs == 1;
+}
 
-	if (unfinishedJobs == 0 && mDependants.size())
-	{
-		for (auto dependant : mDependants)
-		{
-			dependant->mUnfinishedJobs--;
-			HTL_LOGI("Having dependant " << dependant->mName << " with now open dependecies: " << (int)dependant->mUnfinishedJobs.load());
-		}
-	}
+void Job::Reset(int_fast32_t unfinishedJobs)
+{
+	mUnfinishedJobs.store(unfinishedJobs, std::memory_order_relaxed);
+	mContinuations.store(nullptr, std::memory_order_relaxed);
 }
 
-std::string Job::GetName() const
+const char* Job::GetName() const
 {
+#ifdef HTL_JOB_NAMES
 	return mName;
+#else
+	return "job";
+#endif
 }
 
 int_fast32_t Job::GetUnfinishedJobs() const
@@ -67,7 +202,43 @@ int_fast32_t Job::GetUnfinishedJobs() const
 	return mUnfinishedJobs;
 }
 
+JobPriority Job::GetPriority() const
+{
+	return mPriority;
+}
+
+JobPriority Job::GetCurrentPriority()
+{
+	return sCurrentPriority;
+}
+
+Job* Job::GetCurrentJob()
+{
+	return sCurrentJob;
+}
+
+void Job::SetCurrentJob(Job* job, JobPriority priority)
+{
+	sCurrentJob = job;
+	sCurrentPriority = priority;
+}
+
+void Job::SuspendCurrentJob(bool suspend)
+{
+	sSuspendCurrentJob = suspend;
+}
+
+bool Job::HasDependencies() const
+{
+	return mNumDependencies > 0;
+}
+
+void Job::SetCounter(JobCounter* counter)
+{
+	mCounter = counter;
+}
+
 bool Job::HasDependants() const
 {
-	return !mDependants.empty();
+	return mNumDependants > 0;
 }
\ No newline at end of file
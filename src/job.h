@@ -2,36 +2,78 @@
 
 #include <atomic>
 #include <thread>
-#include <vector>
-#include <string>
+#include <cstdint>
+
+#include "defines.h"
+#include "job_function.h"
+
+class JobSystem;
+
+// workers always run the most urgent job they can find, every priority has its own deque per worker
+// background jobs still get a turn now and then, see JobWorker::MAX_SKIPS_OF_LOWER_PRIORITIES
+enum class JobPriority : uint8_t
+{
+	// on the critical path of the frame, everything else waits for it
+	Critical,
+	High,
+	Normal,
+	// long running work nobody waits for soon
+	Background
+};
+static const uint32_t NUM_JOB_PRIORITIES = 4;
+
+class Job;
+class JobCounter;
+
+// link of a continuation attached to a job while the program runs, see JobSystem::Then
+// lives in the job arena, so it is freed together with the jobs
+struct JobContinuation
+{
+	Job* Dependant;
+	JobContinuation* Next;
+};
 
 class Job
 {
 private:
-	// additional debug information by providing a readable task name
-	std::string mName;
-
-	// a list of dependants, allowing more constraints
-	std::vector<Job*> mDependants;
-
-	typedef void (*JobFunc)();
-	JobFunc mJobFunction;
+	// hot block, the only cache line touched while dependencies resolve and when the job gets executed
+	// with int32(8) + JobFunction(56) it fills exactly one line, jobs from the arenas are aligned to cache lines
 
 	// atomic type to ensure increment and decrement are visible to all threads
 	// 0 means jobs done
 	// 1 means "this" job has not finished yet
 	// value > 1 means having open dependencies
-	std::atomic_int_fast32_t mUnfinishedJobs{ 1 };
+	alignas(64) std::atomic_int_fast32_t mUnfinishedJobs{ 1 };
+
+	// callable with inline captures, see job_function.h
+	JobFunction mJobFunction;
+
+	// cold block on its own line, only read when the job gets added and when it finishes,
+	// so workers decrementing the counter don't invalidate it
+
+	// a list of dependants, allowing more constraints
+	// not owned, the array has to live as long as the job (JobSystem::CreateJob puts it in the job arena)
+	alignas(64) Job* const* mDependants;
+	uint32_t mNumDependants;
 
-	// may use data and context of any kind but not supported in this exercise
-	//void* mData;
-	//void* mContext;
+	// number of jobs this one depends on, only changed while creating jobs
+	// used to tell jobs scheduled by their last dependency apart from jobs that need to be added
+	std::atomic_uint32_t mNumDependencies{ 0 };
 
-	// could add padding array to align to cache line size to prevent false sharing
-	// char padding[CacheLineBytes(64) - JobFunc(8) - vector(24) - int32(4) - name(32)];
-	// but because of debug features (name) we are already at 72 bytes and couldn't measure any
-	// performance losses that would justify doing so
-	// char padding[2*64 - 72];
+	// continuations attached after construction, newest first
+	// Finish() swaps in a marker, so a continuation attached later knows this job is already done
+	std::atomic<JobContinuation*> mContinuations{ nullptr };
+
+	// counted down when the job finishes, not owned, see job_counter.h
+	JobCounter* mCounter{ nullptr };
+
+	JobPriority mPriority;
+
+#ifdef HTL_JOB_NAMES
+	// additional debug information by providing a readable task name
+	// not owned, expected to be a string literal
+	const char* mName;
+#endif
 
 public:
 	// we don't support jobs with no worker function
@@ -46,25 +88,62 @@ public:
 	Job(Job&&) = delete;
 	Job& operator=(Job&&) = delete;
 
-	Job(JobFunc job, std::string name);
+	Job(const JobFunction& job, const char* name, JobPriority priority = JobPriority::Normal);
 
 	// allow to specify other jobs that define the dependants
-	Job(JobFunc job, std::string name, std::vector<Job*> dependants);
+	Job(const JobFunction& job, const char* name, Job* const* dependants, uint32_t numDependants, JobPriority priority = JobPriority::Normal);
 
 	// need something to check if dependencies are met
 	bool CanExecute() const;
 
-	void Execute();
+	// finishing may schedule dependants that became ready on the given job system
+	// returns the first dependant that became ready, the caller should execute it right away
+	// while its inputs are still in the cache, nullptr if none
+	Job* Execute(JobSystem& jobSystem);
 
 	bool IsFinished() const;
 
-	void Finish();
+	Job* Finish(JobSystem& jobSystem);
+
+	// let continuation wait for this job, link has to live as long as this job
+	// returns false if this job already finished, then the continuation doesn't wait for it
+	bool AddContinuation(JobContinuation* link);
+
+	// one more open dependency, for continuations attached after construction
+	void AddDependency();
+	// returns true if it was the last open dependency, the job is ready then
+	bool ResolveDependency();
+
+	bool HasDependencies() const;
+
+	// only while creating the job, before anyone else knows it
+	void SetCounter(JobCounter* counter);
+
+	// make a finished job runnable again with the given unfinishedJobs (1 + open dependencies)
+	// only allowed if the job is neither scheduled nor running, attached continuations are dropped
+	void Reset(std::int_fast32_t unfinishedJobs);
 
 	// debug functionality for printing additional information
-	// should get stripped away by compiler if not used
-	std::string GetName() const;
+	// names are only kept with HTL_JOB_NAMES, otherwise all jobs are called "job"
+	const char* GetName() const;
 
 	std::int_fast32_t GetUnfinishedJobs() const;
 
+	JobPriority GetPriority() const;
+
+	// priority of the job the calling thread currently executes, Normal outside of jobs
+	// jobs spawned from within a job (e.g. ParallelFor splits) inherit it
+	static JobPriority GetCurrentPriority();
+
+	// job the calling thread currently executes, nullptr outside of jobs
+	static Job* GetCurrentJob();
+	// a fiber takes the job it executes along when it switches, see JobWorker::ParkCurrentFiber
+	static void SetCurrentJob(Job* job, JobPriority priority);
+
+	// only from within the job's own function: when the function returns, the job doesn't finish
+	// but runs again once the dependencies added meanwhile are resolved, see JobTask in job_task.h
+	// another worker may already run it again before the function returned, so it must not touch the job anymore
+	static void SuspendCurrentJob(bool suspend);
+
 	bool HasDependants() const;
 };
\ No newline at end of file
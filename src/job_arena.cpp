@@ -0,0 +1,106 @@
+#include "job_arena.h"
+#include "defines.h"
+
+#include <cstdint>
+#include <cstdlib>
+
+JobArena::JobArena(size_t blockSize)
+	: mBlockSize(blockSize)
+	, mFirstBlock(CreateBlock(blockSize))
+	, mCurrentBlock(mFirstBlock)
+{
+}
+
+JobArena::~JobArena()
+{
+	Block* block = mFirstBlock;
+	while (block != nullptr)
+	{
+		Block* next = block->Next;
+		free(block);
+		block = next;
+	}
+}
+
+void* JobArena::Allocate(size_t size, size_t alignment)
+{
+	Block* block = mCurrentBlock.load(std::memory_order_acquire);
+	while (true)
+	{
+		size_t offset = block->Offset.load(std::memory_order_relaxed);
+		while (true)
+		{
+			uintptr_t address = reinterpret_cast<uintptr_t>(block->Data) + offset;
+			size_t padding = (alignment - (address % alignment)) % alignment;
+			size_t newOffset = offset + padding + size;
+			if (newOffset > block->Capacity)
+			{
+				break;
+			}
+			if (block->Offset.compare_exchange_weak(offset, newOffset, std::memory_order_relaxed))
+			{
+				return block->Data + offset + padding;
+			}
+		}
+
+		// current block is full, switch to the next one
+		block = NextBlock(block, size + alignment);
+	}
+}
+
+void JobArena::Reset()
+{
+	mFirstBlock->Offset.store(0, std::memory_order_relaxed);
+	mCurrentBlock.store(mFirstBlock, std::memory_order_release);
+}
+
+size_t JobArena::GetNumBlocks() const
+{
+	size_t numBlocks = 0;
+	for (Block* block = mFirstBlock; block != nullptr; block = block->Next)
+	{
+		numBlocks++;
+	}
+	return numBlocks;
+}
+
+JobArena::Block* JobArena::CreateBlock(size_t capacity)
+{
+	// header and data in one allocation, data starts on a cache line
+	void* memory = malloc(sizeof(Block) + capacity + CACHE_LINE_SIZE);
+	Block* block = new (memory) Block();
+	uintptr_t data = reinterpret_cast<uintptr_t>(block + 1);
+	data = (data + CACHE_LINE_SIZE - 1) & ~uintptr_t(CACHE_LINE_SIZE - 1);
+	block->Next = nullptr;
+	block->Data = reinterpret_cast<char*>(data);
+	block->Capacity = capacity;
+	block->Offset.store(0, std::memory_order_relaxed);
+	return block;
+}
+
+JobArena::Block* JobArena::NextBlock(Block* full, size_t minCapacity)
+{
+	std::lock_guard<std::mutex> lock(mGrowMutex);
+
+	// another thread may already have switched
+	Block* current = mCurrentBlock.load(std::memory_order_acquire);
+	if (current != full)
+	{
+		return current;
+	}
+
+	// reuse blocks from previous frames if they are big enough, otherwise insert a new one
+	Block* next = full->Next;
+	if (next == nullptr || next->Capacity < minCapacity)
+	{
+		Block* block = CreateBlock(minCapacity > mBlockSize ? minCapacity : mBlockSize);
+		block->Next = next;
+		full->Next = block;
+		next = block;
+		HTL_LOGD("Job arena grown to " << GetNumBlocks() << " blocks");
+	}
+
+	next->Offset.store(0, std::memory_order_relaxed);
+	mCurrentBlock.store(next, std::memory_order_release);
+	return next;
+}
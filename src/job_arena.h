@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <type_traits>
+
+// general information
+// ===================
+// - Linear allocator for everything a frame needs (jobs and their dependant arrays)
+// - Allocating is a CAS on the offset of the current block, so jobs can be created from any thread
+// - If a block runs full, the next one is chained (or reused from a previous frame) under a mutex
+// - Reset() just rewinds to the first block, nothing gets freed or destructed,
+//      so only trivially destructible types are allowed
+// - Every allocation is aligned to a cache line by default, so jobs don't share lines with each other
+
+class JobArena
+{
+public:
+	static const size_t CACHE_LINE_SIZE = 64;
+
+	explicit JobArena(size_t blockSize);
+	~JobArena();
+
+	JobArena(const JobArena&) = delete;
+	JobArena& operator=(const JobArena&) = delete;
+
+	void* Allocate(size_t size, size_t alignment = CACHE_LINE_SIZE);
+
+	template <typename T, typename... Args>
+	T* Create(Args&&... args)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "JobArena never calls destructors");
+		void* memory = Allocate(sizeof(T), alignof(T) > CACHE_LINE_SIZE ? alignof(T) : CACHE_LINE_SIZE);
+		return new (memory) T(std::forward<Args>(args)...);
+	}
+
+	// arrays are only aligned to their element type, they are read by one thread at a time
+	template <typename T>
+	T* CreateArray(size_t count)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "JobArena never calls destructors");
+		void* memory = Allocate(sizeof(T) * count, alignof(T));
+		return new (memory) T[count];
+	}
+
+	// only allowed if no one allocates and all created objects are not used anymore
+	void Reset();
+
+	size_t GetNumBlocks() const;
+
+private:
+	struct Block
+	{
+		Block* Next;
+		char* Data;
+		size_t Capacity;
+		std::atomic<size_t> Offset;
+	};
+
+	Block* CreateBlock(size_t capacity);
+	Block* NextBlock(Block* full, size_t minCapacity);
+
+	const size_t mBlockSize;
+	Block* mFirstBlock;
+	std::atomic<Block*> mCurrentBlock;
+	std::mutex mGrowMutex;
+};
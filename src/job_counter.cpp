@@ -0,0 +1,109 @@
+#include "job_counter.h"
+#include "defines.h"
+
+void JobCounter::Add(int32_t count)
+{
+	mValue.fetch_add(count);
+}
+
+JobCounterWaiter* JobCounter::Decrement()
+{
+	mNumDecrementing.fetch_add(1);
+	mValue.fetch_sub(1);
+
+	// pairs with AddWaiter: either we see the new waiter here or it sees the new value
+	JobCounterWaiter* ready = nullptr;
+	if (mNumWaiters.load() != 0)
+	{
+		Lock();
+		int32_t value = mValue.load();
+		JobCounterWaiter** link = &mWaiters;
+		while (*link != nullptr)
+		{
+			JobCounterWaiter* waiter = *link;
+			if (value <= waiter->Target)
+			{
+				*link = waiter->Next;
+				waiter->Next = ready;
+				ready = waiter;
+				mNumWaiters.fetch_sub(1, std::memory_order_relaxed);
+			}
+			else
+			{
+				link = &waiter->Next;
+			}
+		}
+		Unlock();
+	}
+
+	// the returned waiters live in the job arena, from here on we don't touch the counter anymore
+	mNumDecrementing.fetch_sub(1);
+	return ready;
+}
+
+bool JobCounter::AddWaiter(JobCounterWaiter* waiter)
+{
+	Lock();
+	if (mValue.load() <= waiter->Target)
+	{
+		Unlock();
+		return false;
+	}
+	waiter->Next = mWaiters;
+	mWaiters = waiter;
+	mNumWaiters.fetch_add(1);
+	Unlock();
+
+	// a job may have taken the counter to the target before it saw us in the list
+	if (mValue.load() > waiter->Target)
+	{
+		return true;
+	}
+	Lock();
+	bool removed = false;
+	for (JobCounterWaiter** link = &mWaiters; *link != nullptr; link = &(*link)->Next)
+	{
+		if (*link == waiter)
+		{
+			*link = waiter->Next;
+			mNumWaiters.fetch_sub(1, std::memory_order_relaxed);
+			removed = true;
+			break;
+		}
+	}
+	Unlock();
+	// not in the list anymore means a finishing job took it and resolves it
+	return !removed;
+}
+
+int32_t JobCounter::GetValue() const
+{
+	return mValue.load(std::memory_order_relaxed);
+}
+
+bool JobCounter::HasReached(int32_t target) const
+{
+	// the value first, the job that decremented it counts as decrementing until it is done
+	return mValue.load() <= target && mNumDecrementing.load() == 0;
+}
+
+void JobCounter::WaitWhileDecrementing() const
+{
+	while (mNumDecrementing.load() != 0)
+	{
+		HTL_CPU_PAUSE();
+	}
+}
+
+void JobCounter::Lock()
+{
+	while (mLocked.exchange(true, std::memory_order_acquire))
+	{
+		HTL_CPU_PAUSE();
+	}
+}
+
+void JobCounter::Unlock()
+{
+	mLocked.store(false, std::memory_order_release);
+}
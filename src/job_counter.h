@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// general information
+// ===================
+// - Counts the unfinished jobs of a batch, e.g. one physics island, so a batch can be waited for
+//      without waiting for unrelated work
+//
+//      JobCounter island;
+//      for (Body& body : bodies)
+//      {
+//          jobSystem.AddJob(jobSystem.CreateJob({ &Integrate, &body }, "integrate", island));
+//      }
+//      jobSystem.WaitForCounter(island);
+//
+// - Every job created with the counter adds one and takes it away again when it finishes
+// - A wait returns once the value is at or below the target, 0 means all jobs of the batch are done
+// - Waiting jobs register a waiter instead of polling (parked fibers, suspended JobTasks), the job
+//      taking the counter to the target resolves them like a continuation, see JobSystem::Then
+// - The counter is owned by the caller and may live on the stack: waits only return once no finishing
+//      job touches the counter anymore
+
+class Job;
+
+// lives in the job arena, so it is freed together with the jobs
+struct JobCounterWaiter
+{
+	Job* Dependant;
+	int32_t Target;
+	JobCounterWaiter* Next;
+};
+
+class JobCounter
+{
+public:
+	JobCounter() = default;
+
+	JobCounter(const JobCounter&) = delete;
+	JobCounter& operator=(const JobCounter&) = delete;
+
+	// more unfinished jobs, JobSystem::CreateJob adds one for every job created with the counter
+	void Add(int32_t count);
+
+	// returns the waiters whose target was reached, they are not linked to the counter anymore
+	// and the caller resolves them, usually Job::Finish
+	JobCounterWaiter* Decrement();
+
+	// returns false if the target is already reached, then the waiter isn't added
+	bool AddWaiter(JobCounterWaiter* waiter);
+
+	// only a snapshot
+	int32_t GetValue() const;
+	// at or below target and no finishing job touches the counter anymore
+	bool HasReached(int32_t target) const;
+
+	// a woken waiter may run before the job that woke it left Decrement, wait for that before the counter goes away
+	void WaitWhileDecrementing() const;
+
+private:
+	void Lock();
+	void Unlock();
+
+	std::atomic_int32_t mValue{ 0 };
+	// finishing jobs inside Decrement
+	std::atomic_int32_t mNumDecrementing{ 0 };
+	// waiters are rare, so a spin lock around the list is enough
+	JobCounterWaiter* mWaiters{ nullptr };
+	std::atomic_bool mLocked{ false };
+	// read without the lock, so finishing jobs only lock if somebody waits
+	std::atomic_uint32_t mNumWaiters{ 0 };
+};
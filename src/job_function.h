@@ -0,0 +1,105 @@
+#pragma once
+
+// general information
+// ===================
+// - Type erased callable with a fixed inline buffer, so a job can carry lambdas with captures,
+//      member functions or a function with a data pointer without any heap allocation
+// - The callable is copied into the buffer and called through a per type trampoline
+// - Callables have to be trivially copyable: jobs live in arenas which never run destructors,
+//      and the graph copies its functions into the jobs it creates.
+//      Capture pointers or references to bigger or owning data instead of the data itself
+// - Too big or non trivial callables are rejected at compile time, there is never a silent malloc
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+
+class JobFunction
+{
+public:
+    // with the trampoline pointer a JobFunction takes 56 bytes
+    static const size_t STORAGE_SIZE = 48;
+    static const size_t STORAGE_ALIGNMENT = alignof(void*);
+
+    JobFunction() = default;
+
+    // any callable without arguments, also plain function pointers
+    template <typename Callable, typename = typename std::enable_if<!std::is_same<typename std::decay<Callable>::type, JobFunction>::value>::type>
+    JobFunction(Callable&& callable)
+    {
+        typedef typename std::decay<Callable>::type Function;
+        static_assert(std::is_invocable<Function&>::value, "JobFunction: callable has to be invocable without arguments");
+        static_assert(sizeof(Function) <= STORAGE_SIZE, "JobFunction: callable too big for the inline storage, capture a pointer to the data instead");
+        static_assert(alignof(Function) <= STORAGE_ALIGNMENT, "JobFunction: callable needs a bigger alignment than the inline storage provides");
+        static_assert(std::is_trivially_copyable<Function>::value, "JobFunction: callable has to be trivially copyable, jobs are never destroyed");
+
+        new (mStorage) Function(static_cast<Callable&&>(callable));
+        mInvoke = &Invoke<Function>;
+    }
+
+    // classic function + user data
+    JobFunction(void (*function)(void*), void* data)
+        : JobFunction(FunctionWithData{ function, data })
+    {
+    }
+
+    // member function on an object, the object has to outlive the job
+    template <typename T>
+    JobFunction(void (T::*method)(), T* object)
+        : JobFunction([method, object]() { (object->*method)(); })
+    {
+    }
+
+    template <typename T>
+    JobFunction(void (T::*method)() const, const T* object)
+        : JobFunction([method, object]() { (object->*method)(); })
+    {
+    }
+
+    void operator()()
+    {
+        mInvoke(mStorage);
+    }
+
+    explicit operator bool() const
+    {
+        return mInvoke != nullptr;
+    }
+
+    // identifies the kind of job without a name, see JobStats
+    // plain functions (also with user data) are their own key, any other callable is keyed by its type,
+    // so every lambda expression is one kind, no matter what it captured
+    const void* GetKey() const
+    {
+        if (mInvoke == &Invoke<void (*)()>)
+        {
+            return reinterpret_cast<const void*>(*reinterpret_cast<void (* const*)()>(mStorage));
+        }
+        if (mInvoke == &Invoke<FunctionWithData>)
+        {
+            return reinterpret_cast<const void*>(reinterpret_cast<const FunctionWithData*>(mStorage)->Function);
+        }
+        return reinterpret_cast<const void*>(mInvoke);
+    }
+
+private:
+    struct FunctionWithData
+    {
+        void (*Function)(void*);
+        void* Data;
+
+        void operator()() const
+        {
+            Function(Data);
+        }
+    };
+
+    template <typename Function>
+    static void Invoke(void* storage)
+    {
+        (*static_cast<Function*>(storage))();
+    }
+
+    void (*mInvoke)(void*) = nullptr;
+    alignas(STORAGE_ALIGNMENT) unsigned char mStorage[STORAGE_SIZE];
+};
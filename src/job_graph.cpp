@@ -0,0 +1,279 @@
+#include "job_graph.h"
+#include "job_system.h"
+#include "defines.h"
+
+#include <algorithm>
+
+JobGraph::JobGraph()
+	: mTotalCost(0)
+	, mMaxUsefulWorkers(1)
+	, mArena(ARENA_BLOCK_SIZE)
+	, mBuilt(false)
+{
+}
+
+JobGraph::NodeId JobGraph::AddNode(const JobFunction& function, const char* name, JobPriority priority, uint32_t estimatedCost)
+{
+	if (mBuilt)
+	{
+		HTL_LOGE("Can't add node " << name << " to an already built job graph");
+		return static_cast<NodeId>(mNodes.size());
+	}
+	mNodes.push_back({ function, name, priority, estimatedCost, {} });
+	return static_cast<NodeId>(mNodes.size() - 1);
+}
+
+void JobGraph::AddDependency(NodeId dependency, NodeId dependant)
+{
+	if (mBuilt || dependency >= mNodes.size() || dependant >= mNodes.size())
+	{
+		HTL_LOGE("Invalid dependency " << dependency << " -> " << dependant << " in job graph");
+		return;
+	}
+	mNodes[dependency].Dependants.push_back(dependant);
+}
+
+bool JobGraph::Build()
+{
+	if (mBuilt)
+	{
+		return true;
+	}
+
+	// Kahn's algorithm, nodes without open dependencies are next in order
+	std::vector<uint32_t> numDependencies(mNodes.size(), 0);
+	for (const Node& node : mNodes)
+	{
+		for (NodeId dependant : node.Dependants)
+		{
+			numDependencies[dependant]++;
+		}
+	}
+
+	mTopologicalOrder.clear();
+	mRoots.clear();
+	for (NodeId id = 0; id < mNodes.size(); id++)
+	{
+		if (numDependencies[id] == 0)
+		{
+			mTopologicalOrder.push_back(id);
+			mRoots.push_back(id);
+		}
+	}
+
+	std::vector<uint32_t> openDependencies(numDependencies);
+	for (size_t i = 0; i < mTopologicalOrder.size(); i++)
+	{
+		for (NodeId dependant : mNodes[mTopologicalOrder[i]].Dependants)
+		{
+			if (--openDependencies[dependant] == 0)
+			{
+				mTopologicalOrder.push_back(dependant);
+			}
+		}
+	}
+
+	if (mTopologicalOrder.size() != mNodes.size())
+	{
+		HTL_LOGE("Job graph contains a cycle, only " << mTopologicalOrder.size() << " of " << mNodes.size() << " nodes can be ordered");
+		mTopologicalOrder.clear();
+		mRoots.clear();
+		return false;
+	}
+
+	ComputeBottomLevels();
+
+	// create jobs in reverse order, so all dependants already exist
+	// the job constructor then also counts the initial dependencies for us
+	mJobs.assign(mNodes.size(), nullptr);
+	mDependantArrays.assign(mNodes.size(), nullptr);
+	mInitialUnfinishedJobs.assign(mNodes.size(), 1);
+	for (auto it = mTopologicalOrder.rbegin(); it != mTopologicalOrder.rend(); ++it)
+	{
+		const Node& node = mNodes[*it];
+		if (node.Dependants.empty())
+		{
+			mJobs[*it] = mArena.Create<Job>(node.Function, node.Name, node.Priority);
+			continue;
+		}
+
+		mDependantArrays[*it] = mArena.CreateArray<Job*>(node.Dependants.size());
+		OrderDependants(*it);
+		mJobs[*it] = mArena.Create<Job>(node.Function, node.Name, mDependantArrays[*it], static_cast<uint32_t>(node.Dependants.size()), node.Priority);
+	}
+
+	for (NodeId id = 0; id < mNodes.size(); id++)
+	{
+		mInitialUnfinishedJobs[id] = mJobs[id]->GetUnfinishedJobs();
+	}
+
+	mBuilt = true;
+	HTL_LOGD("Built job graph with " << mNodes.size() << " nodes and " << mRoots.size() << " roots, critical path: " << GetCriticalPathLength());
+	return true;
+}
+
+void JobGraph::UpdateCosts(const JobStats& jobStats)
+{
+	if (!mBuilt)
+	{
+		return;
+	}
+
+	for (Node& node : mNodes)
+	{
+		uint64_t nanoseconds;
+		if (jobStats.GetEma(node.Function.GetKey(), nanoseconds))
+		{
+			node.EstimatedCost = static_cast<uint32_t>(std::clamp<uint64_t>((nanoseconds + 500) / 1000, 1, UINT32_MAX));
+		}
+	}
+
+	ComputeBottomLevels();
+	for (NodeId id = 0; id < mNodes.size(); id++)
+	{
+		if (mDependantArrays[id] != nullptr)
+		{
+			OrderDependants(id);
+		}
+	}
+}
+
+void JobGraph::ComputeBottomLevels()
+{
+	// reverse topological order, so the levels of all dependants are known
+	mBottomLevels.assign(mNodes.size(), 0);
+	mTotalCost = 0;
+	for (auto it = mTopologicalOrder.rbegin(); it != mTopologicalOrder.rend(); ++it)
+	{
+		uint64_t longestChain = 0;
+		for (NodeId dependant : mNodes[*it].Dependants)
+		{
+			longestChain = std::max(longestChain, mBottomLevels[dependant]);
+		}
+		mBottomLevels[*it] = mNodes[*it].EstimatedCost + longestChain;
+		mTotalCost += mNodes[*it].EstimatedCost;
+	}
+
+	// the first submitted root is the first one an idle worker picks up
+	std::stable_sort(mRoots.begin(), mRoots.end(), [this](NodeId a, NodeId b) { return mBottomLevels[a] > mBottomLevels[b]; });
+
+	// with unlimited workers every job starts as soon as its last dependency is done,
+	// the most jobs running at the same time in that schedule is all the graph can ever use
+	std::vector<uint64_t> starts(mNodes.size(), 0);
+	std::vector<std::pair<uint64_t, int32_t>> events;
+	for (NodeId id : mTopologicalOrder)
+	{
+		uint64_t end = starts[id] + mNodes[id].EstimatedCost;
+		for (NodeId dependant : mNodes[id].Dependants)
+		{
+			starts[dependant] = std::max(starts[dependant], end);
+		}
+		events.push_back({ starts[id], 1 });
+		events.push_back({ end, -1 });
+	}
+	// ends sort before starts at the same time, a dependant takes over the worker of its dependency
+	std::sort(events.begin(), events.end());
+	int32_t running = 0;
+	mMaxUsefulWorkers = 1;
+	for (const std::pair<uint64_t, int32_t>& event : events)
+	{
+		running += event.second;
+		mMaxUsefulWorkers = std::max(mMaxUsefulWorkers, static_cast<uint32_t>(std::max(running, 0)));
+	}
+}
+
+void JobGraph::OrderDependants(NodeId id)
+{
+	// a finishing worker runs the first ready dependant itself and schedules the others,
+	// so the highest bottom level goes first and continues on the hot worker, thieves take the shorter chains
+	std::vector<NodeId> ordered(mNodes[id].Dependants);
+	std::stable_sort(ordered.begin(), ordered.end(), [this](NodeId a, NodeId b) { return mBottomLevels[a] > mBottomLevels[b]; });
+	for (size_t i = 0; i < ordered.size(); i++)
+	{
+		mDependantArrays[id][i] = mJobs[ordered[i]];
+	}
+}
+
+bool JobGraph::IsBuilt() const
+{
+	return mBuilt;
+}
+
+void JobGraph::Submit(JobSystem& jobSystem)
+{
+	if (!mBuilt)
+	{
+		HTL_LOGE("Job graph has to be built before submitting");
+		return;
+	}
+
+	// all counters first, a root may already finish while we are still submitting
+	for (NodeId id = 0; id < mJobs.size(); id++)
+	{
+		mJobs[id]->Reset(mInitialUnfinishedJobs[id]);
+#ifdef HTL_JOB_STATS
+		jobSystem.GetJobStats().SetName(mNodes[id].Function.GetKey(), mNodes[id].Name);
+#endif
+	}
+	std::atomic_thread_fence(std::memory_order_release);
+
+	// other threads submit through the injection queue, which hands out the oldest root first
+	// a worker pushes to its own deque and pops the newest first, so it submits the other way round
+	JobWorker* worker = JobWorker::GetCurrentWorker();
+	if (worker != nullptr && worker->GetJobSystem() == &jobSystem)
+	{
+		for (auto it = mRoots.rbegin(); it != mRoots.rend(); ++it)
+		{
+			jobSystem.AddJob(mJobs[*it]);
+		}
+		return;
+	}
+	for (NodeId root : mRoots)
+	{
+		jobSystem.AddJob(mJobs[root]);
+	}
+}
+
+void JobGraph::Wait(JobSystem& jobSystem)
+{
+	// every job instead of tracking the sinks, the finished ones return right away
+	for (Job* job : mJobs)
+	{
+		jobSystem.WaitFor(job);
+	}
+}
+
+uint32_t JobGraph::GetNumNodes() const
+{
+	return static_cast<uint32_t>(mNodes.size());
+}
+
+const std::vector<JobGraph::NodeId>& JobGraph::GetTopologicalOrder() const
+{
+	return mTopologicalOrder;
+}
+
+uint64_t JobGraph::GetBottomLevel(NodeId id) const
+{
+	return id < mBottomLevels.size() ? mBottomLevels[id] : 0;
+}
+
+uint64_t JobGraph::GetCriticalPathLength() const
+{
+	uint64_t length = 0;
+	for (NodeId root : mRoots)
+	{
+		length = std::max(length, mBottomLevels[root]);
+	}
+	return length;
+}
+
+uint64_t JobGraph::GetTotalCost() const
+{
+	return mTotalCost;
+}
+
+uint32_t JobGraph::GetMaxUsefulWorkers() const
+{
+	return mMaxUsefulWorkers;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "job.h"
+#include "job_arena.h"
+#include "job_stats.h"
+
+#include <vector>
+
+class JobSystem;
+
+// general information
+// ===================
+// - Describes a fixed set of jobs and their dependencies, which is built and validated once
+//      and then submitted every frame without creating any jobs
+// - Build() checks for cycles, computes the topological order and creates all jobs in the graph's own arena,
+//      which also leaves every job with its initial dependency count
+// - Submit() only rewrites the counters from the precomputed array and adds the root jobs
+// - Build() also computes every node's bottom level: its own estimated cost plus the most expensive
+//      chain of dependants after it. The longest of them is the critical path, no schedule can be faster.
+//      Roots are submitted and ready dependants are pushed so the highest bottom level runs first,
+//      which keeps the critical path moving while the short chains fill the gaps
+// - UpdateCosts() replaces the estimates with the measured averages of the job stats and reorders the dispatch
+// - A graph can only be submitted again after Wait() returned
+
+class JobGraph
+{
+public:
+	typedef uint32_t NodeId;
+
+	JobGraph();
+
+	JobGraph(const JobGraph&) = delete;
+	JobGraph& operator=(const JobGraph&) = delete;
+
+	// estimatedCost in microseconds, the unit UpdateCosts() uses as well
+	// without estimates every node costs 1, so the longest chain of nodes wins
+	NodeId AddNode(const JobFunction& function, const char* name, JobPriority priority = JobPriority::Normal, uint32_t estimatedCost = 1);
+
+	// dependant is executed after dependency finished
+	void AddDependency(NodeId dependency, NodeId dependant);
+
+	// returns false if the graph contains a cycle
+	bool Build();
+	bool IsBuilt() const;
+
+	void Submit(JobSystem& jobSystem);
+
+	// takes the measured average of every node that has one as its new cost and recomputes the dispatch order
+	// only allowed while the graph is not running, i.e. before the first Submit() or after Wait()
+	void UpdateCosts(const JobStats& jobStats);
+
+	// waits for every job of the graph, the calling thread helps meanwhile
+	void Wait(JobSystem& jobSystem);
+
+	uint32_t GetNumNodes() const;
+	const std::vector<NodeId>& GetTopologicalOrder() const;
+
+	// estimated cost of the node and its most expensive chain of dependants, only valid after Build()
+	uint64_t GetBottomLevel(NodeId id) const;
+	// estimated lower bound for the whole graph, no matter how many workers there are
+	uint64_t GetCriticalPathLength() const;
+	uint64_t GetTotalCost() const;
+	// enough workers to finish the graph within its critical path, more can't make it any faster
+	uint32_t GetMaxUsefulWorkers() const;
+
+private:
+	struct Node
+	{
+		JobFunction Function;
+		const char* Name;
+		JobPriority Priority;
+		uint32_t EstimatedCost;
+		std::vector<NodeId> Dependants;
+	};
+
+	// enough for a lot of nodes, the arena chains more blocks if needed
+	static const size_t ARENA_BLOCK_SIZE = 16 * 1024;
+
+	// fills mBottomLevels, mTotalCost and mMaxUsefulWorkers, sorts the roots
+	void ComputeBottomLevels();
+	// writes the dependants of a node into its job's array, highest bottom level first
+	void OrderDependants(NodeId id);
+
+	std::vector<Node> mNodes;
+	std::vector<NodeId> mTopologicalOrder;
+	// highest bottom level first
+	std::vector<NodeId> mRoots;
+	// indexed by NodeId, filled by Build()
+	std::vector<uint64_t> mBottomLevels;
+	uint64_t mTotalCost;
+	uint32_t mMaxUsefulWorkers;
+
+	// indexed by NodeId, filled by Build()
+	std::vector<Job*> mJobs;
+	// the dependants array each job points to, nullptr for nodes without dependants
+	std::vector<Job**> mDependantArrays;
+	std::vector<std::int_fast32_t> mInitialUnfinishedJobs;
+
+	JobArena mArena;
+	bool mBuilt;
+};
@@ -0,0 +1,154 @@
+#include "job_pool.h"
+#include "defines.h"
+
+#include <algorithm>
+
+JobPool::JobPool(uint32_t firstIndex, uint32_t capacity)
+	: mFirstIndex(firstIndex)
+	, mCapacity((capacity + CHUNK_SIZE - 1) & ~(CHUNK_SIZE - 1))
+	, mFreeSlots(NO_SLOT)
+	, mChunks(new std::atomic<Chunk*>[mCapacity / CHUNK_SIZE])
+{
+	for (uint32_t i = 0; i < mCapacity / CHUNK_SIZE; i++)
+	{
+		mChunks[i].store(nullptr, std::memory_order_relaxed);
+	}
+}
+
+JobPool::~JobPool()
+{
+	for (uint32_t i = 0; i < mNumChunks.load(std::memory_order_relaxed); i++)
+	{
+		delete mChunks[i].load(std::memory_order_relaxed);
+	}
+	delete[] mChunks;
+}
+
+void JobPool::ReleaseAll()
+{
+	// the free stack held the linked slots in index order and only grown chunks were pushed on top once it ran empty,
+	// so the first numJobs of them are the ones handed out, or all of them if the pool had to grow
+	uint32_t numSlots = GetNumSlots();
+	uint32_t numUsedSlots = std::min(mNumJobs.load(std::memory_order_relaxed), mNumLinkedSlots);
+	for (uint32_t slot = 0; slot < numUsedSlots; slot++)
+	{
+		ReleaseSlot(slot);
+	}
+
+	// grown chunks are new this frame, so walking them costs no more than growing did, their links are rebuilt in index order
+	// popping never changes the links, the older slots still point to their successor
+	if (numSlots > mNumLinkedSlots)
+	{
+		if (mNumLinkedSlots > 0)
+		{
+			NextFree(mNumLinkedSlots - 1).store(mNumLinkedSlots, std::memory_order_relaxed);
+		}
+		for (uint32_t slot = mNumLinkedSlots; slot < numSlots; slot++)
+		{
+			ReleaseSlot(slot);
+			NextFree(slot).store(slot + 1 < numSlots ? slot + 1 : NO_SLOT, std::memory_order_relaxed);
+		}
+		mNumLinkedSlots = numSlots;
+	}
+
+	// no one else touches the pool right now, the next frame starts at the first slot again
+	uint64_t tag = (mFreeSlots.load(std::memory_order_relaxed) >> 32) + 1;
+	mFreeSlots.store((tag << 32) | (numSlots > 0 ? 0 : NO_SLOT), std::memory_order_release);
+	mNumJobs.store(0, std::memory_order_relaxed);
+}
+
+void JobPool::ReleaseSlot(uint32_t slot)
+{
+	std::atomic_uint32_t& generation = mChunks[slot >> CHUNK_BITS].load(std::memory_order_relaxed)->Generations[slot & (CHUNK_SIZE - 1)];
+	uint32_t value = generation.load(std::memory_order_relaxed);
+	if ((value & 1) != 0)
+	{
+		generation.store((value + 1) & JobHandle::GENERATION_MASK, std::memory_order_relaxed);
+	}
+}
+
+uint32_t JobPool::GetNumJobs() const
+{
+	return mNumJobs.load(std::memory_order_relaxed);
+}
+
+uint32_t JobPool::GetNumSlots() const
+{
+	return mNumChunks.load(std::memory_order_acquire) * CHUNK_SIZE;
+}
+
+uint32_t JobPool::PopFreeSlot()
+{
+	uint64_t head = mFreeSlots.load(std::memory_order_acquire);
+	while (true)
+	{
+		uint32_t slot = static_cast<uint32_t>(head);
+		if (slot == NO_SLOT)
+		{
+			if (!Grow())
+			{
+				return NO_SLOT;
+			}
+			head = mFreeSlots.load(std::memory_order_acquire);
+			continue;
+		}
+
+		// the slot may be taken by someone else meanwhile, then the tag changed and the CAS fails
+		uint64_t next = ((head >> 32) + 1) << 32 | NextFree(slot).load(std::memory_order_relaxed);
+		if (mFreeSlots.compare_exchange_weak(head, next, std::memory_order_acq_rel, std::memory_order_acquire))
+		{
+			mNumJobs.fetch_add(1, std::memory_order_relaxed);
+			return slot;
+		}
+	}
+}
+
+void JobPool::PushFreeSlots(uint32_t first, uint32_t last)
+{
+	uint64_t head = mFreeSlots.load(std::memory_order_relaxed);
+	uint64_t next;
+	do
+	{
+		NextFree(last).store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+		next = ((head >> 32) + 1) << 32 | first;
+	} while (!mFreeSlots.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed));
+}
+
+bool JobPool::Grow()
+{
+	std::lock_guard<std::mutex> lock(mGrowMutex);
+
+	// creators finding the free stack empty at the same time queue up here, only the first one grows
+	// only Grow pushes while jobs are created, so a non-empty stack means someone grew meanwhile
+	if (static_cast<uint32_t>(mFreeSlots.load(std::memory_order_acquire)) != NO_SLOT)
+	{
+		return true;
+	}
+
+	uint32_t numChunks = mNumChunks.load(std::memory_order_relaxed);
+	if (numChunks == mCapacity / CHUNK_SIZE)
+	{
+		HTL_LOGE("Job pool is full with " << mCapacity << " jobs, no more jobs can be created until the jobs are reset");
+		return false;
+	}
+
+	// pages of the chunk are first touched here, so they end up on the NUMA node of the creating thread
+	Chunk* chunk = new Chunk();
+	uint32_t first = numChunks * CHUNK_SIZE;
+	for (uint32_t i = 0; i < CHUNK_SIZE; i++)
+	{
+		chunk->Generations[i].store(0, std::memory_order_relaxed);
+		chunk->NextFree[i].store(first + i + 1, std::memory_order_relaxed);
+	}
+	mChunks[numChunks].store(chunk, std::memory_order_release);
+	mNumChunks.store(numChunks + 1, std::memory_order_release);
+	HTL_LOGD("Job pool grown to " << (numChunks + 1) * CHUNK_SIZE << " jobs");
+
+	PushFreeSlots(first, first + CHUNK_SIZE - 1);
+	return true;
+}
+
+std::atomic_uint32_t& JobPool::NextFree(uint32_t slot) const
+{
+	return mChunks[slot >> CHUNK_BITS].load(std::memory_order_relaxed)->NextFree[slot & (CHUNK_SIZE - 1)];
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include "job.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+// general information
+// ===================
+// - Table of job slots that hands out 32 bit JobHandles instead of raw pointers
+// - A handle is a slot index plus the generation of the slot when the job was created. Every slot counts
+//      its generation up when a job is created in it and again when the job is released, so live jobs have
+//      odd generations. Looking up a handle of a released job compares one number and returns nullptr
+// - Slots are grown in chunks of CHUNK_SIZE the first time they are needed and never freed while the pool
+//      lives, so a pool that has seen its peak number of jobs doesn't allocate anymore
+// - Free slots are kept in a lock-free stack with a tag against ABA, so jobs can be created from any thread
+// - ReleaseAll() recycles every slot at once (like JobArena::Reset). The free stack is kept in index order, so a
+//      frame fills the slots front to back and the reset only touches the slots handed out since the last one
+// - Stale handles are only detected while their slot's generation hasn't come around again, see JobHandle
+// - Jobs are trivially destructible (see JobArena), releasing a slot never runs a destructor
+
+// the 12 bit generation wraps after 4096 steps, every job in a slot takes two (create and release), so a handle
+// kept for 2048 later jobs in its slot (e.g. 2048 frames with ResetJobs) may find one of them instead of nullptr
+struct JobHandle
+{
+	// index bits in front, the generation below, 0 is never a live generation so a zeroed handle is invalid
+	static const uint32_t GENERATION_BITS = 12;
+	static const uint32_t INDEX_BITS = 32 - GENERATION_BITS;
+	static const uint32_t GENERATION_MASK = (1u << GENERATION_BITS) - 1;
+	static const uint32_t MAX_INDEX = (1u << INDEX_BITS) - 1;
+
+	uint32_t Value{ 0 };
+
+	JobHandle() = default;
+	JobHandle(uint32_t index, uint32_t generation)
+		: Value{ (index << GENERATION_BITS) | (generation & GENERATION_MASK) }
+	{
+	}
+
+	uint32_t GetIndex() const { return Value >> GENERATION_BITS; }
+	uint32_t GetGeneration() const { return Value & GENERATION_MASK; }
+
+	// only tells if the handle was ever handed out, use JobSystem::GetJob to check if it is still alive
+	bool IsValid() const { return (Value & 1) != 0; }
+
+	bool operator==(const JobHandle& other) const { return Value == other.Value; }
+	bool operator!=(const JobHandle& other) const { return Value != other.Value; }
+};
+
+class JobPool
+{
+public:
+	static const uint32_t CHUNK_BITS = 8;
+	static const uint32_t CHUNK_SIZE = 1u << CHUNK_BITS;
+
+	// the pool owns the handle indices [firstIndex, firstIndex + capacity), capacity is rounded up to whole chunks
+	JobPool(uint32_t firstIndex, uint32_t capacity);
+	~JobPool();
+
+	JobPool(const JobPool&) = delete;
+	JobPool& operator=(const JobPool&) = delete;
+
+	// may be called from any thread, returns an invalid handle if the pool is full
+	template <typename... Args>
+	JobHandle Create(Job*& job, Args&&... args)
+	{
+		uint32_t slot = PopFreeSlot();
+		if (slot == NO_SLOT)
+		{
+			job = nullptr;
+			return JobHandle();
+		}
+
+		Chunk* chunk = mChunks[slot >> CHUNK_BITS].load(std::memory_order_relaxed);
+		uint32_t slotInChunk = slot & (CHUNK_SIZE - 1);
+		job = new (chunk->Jobs[slotInChunk].Memory) Job(std::forward<Args>(args)...);
+
+		// publish the job only after it is constructed, an odd generation means alive
+		uint32_t generation = (chunk->Generations[slotInChunk].load(std::memory_order_relaxed) + 1) & JobHandle::GENERATION_MASK;
+		chunk->Generations[slotInChunk].store(generation, std::memory_order_release);
+		return JobHandle(mFirstIndex + slot, generation);
+	}
+
+	// nullptr if the handle doesn't belong to this pool or its job was already released, may be called from any thread
+	Job* Get(JobHandle handle) const
+	{
+		uint32_t slot = handle.GetIndex() - mFirstIndex;
+		if (!handle.IsValid() || slot >= mCapacity)
+		{
+			return nullptr;
+		}
+		Chunk* chunk = mChunks[slot >> CHUNK_BITS].load(std::memory_order_acquire);
+		uint32_t slotInChunk = slot & (CHUNK_SIZE - 1);
+		if (chunk == nullptr || chunk->Generations[slotInChunk].load(std::memory_order_acquire) != handle.GetGeneration())
+		{
+			return nullptr;
+		}
+		return reinterpret_cast<Job*>(chunk->Jobs[slotInChunk].Memory);
+	}
+
+	// releases every job at once, all their handles turn stale, costs the number of jobs since the last call
+	// only allowed if no one creates jobs and all created jobs are finished and not used anymore
+	void ReleaseAll();
+
+	// slots with a live job right now, only a snapshot
+	uint32_t GetNumJobs() const;
+	// slots allocated so far, the peak number of jobs rounded up to whole chunks
+	uint32_t GetNumSlots() const;
+
+private:
+	static const uint32_t NO_SLOT = UINT32_MAX;
+
+	struct alignas(64) JobMemory
+	{
+		alignas(Job) unsigned char Memory[sizeof(Job)];
+	};
+
+	struct Chunk
+	{
+		JobMemory Jobs[CHUNK_SIZE];
+		// generations of all slots packed together, a lookup touches one line here and one at the job
+		std::atomic_uint32_t Generations[CHUNK_SIZE];
+		// next free slot in the free stack, only meaningful while the slot is free
+		std::atomic_uint32_t NextFree[CHUNK_SIZE];
+	};
+
+	uint32_t PopFreeSlot();
+	// turns the slot's generation even again if a job lives in it
+	void ReleaseSlot(uint32_t slot);
+	// pushes the already linked slots first..last in one go
+	void PushFreeSlots(uint32_t first, uint32_t last);
+	// pushes the slots of a new chunk, unless another creator already did while we waited for the lock
+	// returns false if the pool is at its capacity
+	bool Grow();
+
+	std::atomic_uint32_t& NextFree(uint32_t slot) const;
+
+	const uint32_t mFirstIndex;
+	const uint32_t mCapacity;
+
+	// top slot in the low half, a counter in the high half that changes with every push and pop against ABA
+	std::atomic_uint64_t mFreeSlots;
+	std::atomic_uint32_t mNumJobs{ 0 };
+	// slots linked in index order by the last ReleaseAll, chunks grown since are linked by the next one
+	uint32_t mNumLinkedSlots{ 0 };
+
+	std::atomic<Chunk*>* mChunks;
+	std::atomic_uint32_t mNumChunks{ 0 };
+	std::mutex mGrowMutex;
+};
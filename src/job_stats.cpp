@@ -0,0 +1,238 @@
+#include "job_stats.h"
+#include "defines.h"
+
+#include <algorithm>
+#include <bit>
+#include <fstream>
+
+JobStats::JobStats()
+	: mEntries(new Entry[CAPACITY])
+{
+}
+
+JobStats::~JobStats()
+{
+	delete[] mEntries;
+}
+
+void JobStats::Record(const void* key, uint64_t nanoseconds)
+{
+	Entry* entry = Find(key, true);
+	if (entry == nullptr)
+	{
+		return;
+	}
+
+	entry->Histogram[GetBucket(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+	entry->TotalNanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+	entry->Count.fetch_add(1, std::memory_order_relaxed);
+
+	uint64_t min = entry->MinNanoseconds.load(std::memory_order_relaxed);
+	while (nanoseconds < min && !entry->MinNanoseconds.compare_exchange_weak(min, nanoseconds, std::memory_order_relaxed));
+	uint64_t max = entry->MaxNanoseconds.load(std::memory_order_relaxed);
+	while (nanoseconds > max && !entry->MaxNanoseconds.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed));
+
+	// ema += (sample - ema) / 2^EMA_SHIFT, the first sample is taken as it is
+	uint64_t ema = entry->EmaNanoseconds.load(std::memory_order_relaxed);
+	uint64_t newEma;
+	do
+	{
+		int64_t difference = static_cast<int64_t>(nanoseconds) - static_cast<int64_t>(ema);
+		newEma = ema == 0 ? nanoseconds : static_cast<uint64_t>(static_cast<int64_t>(ema) + difference / (1 << EMA_SHIFT));
+		newEma = std::max<uint64_t>(newEma, 1);
+	} while (!entry->EmaNanoseconds.compare_exchange_weak(ema, newEma, std::memory_order_relaxed));
+}
+
+void JobStats::SetName(const void* key, const char* name)
+{
+	Entry* entry = Find(key, true);
+	if (entry == nullptr || entry->Name.load(std::memory_order_relaxed) != nullptr)
+	{
+		return;
+	}
+	const char* noName = nullptr;
+	entry->Name.compare_exchange_strong(noName, name, std::memory_order_relaxed);
+}
+
+bool JobStats::GetEma(const void* key, uint64_t& nanoseconds) const
+{
+	const Entry* entry = Find(key, false);
+	if (entry == nullptr || entry->EmaNanoseconds.load(std::memory_order_relaxed) == 0)
+	{
+		return false;
+	}
+	nanoseconds = entry->EmaNanoseconds.load(std::memory_order_relaxed);
+	return true;
+}
+
+bool JobStats::GetPercentile(const void* key, double percentile, uint64_t& nanoseconds) const
+{
+	const Entry* entry = Find(key, false);
+	if (entry == nullptr || entry->Count.load(std::memory_order_relaxed) == 0)
+	{
+		return false;
+	}
+	nanoseconds = GetPercentile(*entry, percentile);
+	return true;
+}
+
+bool JobStats::GetSummary(const void* key, Summary& summary) const
+{
+	const Entry* entry = Find(key, false);
+	return entry != nullptr && GetSummary(*entry, summary);
+}
+
+std::vector<JobStats::Summary> JobStats::GetSummaries() const
+{
+	std::vector<Summary> summaries;
+	for (uint32_t i = 0; i < CAPACITY; i++)
+	{
+		Summary summary;
+		if (GetSummary(mEntries[i], summary))
+		{
+			summaries.push_back(summary);
+		}
+	}
+	std::sort(summaries.begin(), summaries.end(), [](const Summary& a, const Summary& b)
+	{
+		return a.Count * a.AverageNanoseconds > b.Count * b.AverageNanoseconds;
+	});
+	return summaries;
+}
+
+bool JobStats::WriteCsv(const std::string& path) const
+{
+	std::ofstream file(path);
+	if (!file)
+	{
+		HTL_LOGE("Could not open " << path << " for writing job stats");
+		return false;
+	}
+
+	file << "name,count,average_ns,ema_ns,p50_ns,p90_ns,p99_ns,max_ns\n";
+	for (const Summary& summary : GetSummaries())
+	{
+		file << summary.Name << "," << summary.Count << "," << summary.AverageNanoseconds << "," << summary.EmaNanoseconds << ","
+			<< summary.P50Nanoseconds << "," << summary.P90Nanoseconds << "," << summary.P99Nanoseconds << "," << summary.MaxNanoseconds << "\n";
+	}
+	return true;
+}
+
+void JobStats::Print() const
+{
+	HTL_LOG("Job stats (microsec): name, runs, average, ema, p50, p90, p99, max");
+	for (const Summary& summary : GetSummaries())
+	{
+		HTL_LOG("  " << summary.Name << ", " << summary.Count << ", " << summary.AverageNanoseconds / 1000.0 << ", " << summary.EmaNanoseconds / 1000.0 << ", "
+			<< summary.P50Nanoseconds / 1000.0 << ", " << summary.P90Nanoseconds / 1000.0 << ", " << summary.P99Nanoseconds / 1000.0 << ", " << summary.MaxNanoseconds / 1000.0);
+	}
+}
+
+JobStats::Entry* JobStats::Find(const void* key, bool insert) const
+{
+	// keys are addresses of functions, the low bits are mostly alignment
+	uint64_t hash = (reinterpret_cast<uintptr_t>(key) >> 3) * 0x9E3779B97F4A7C15ull;
+	uint32_t start = static_cast<uint32_t>(hash >> 32) & (CAPACITY - 1);
+	for (uint32_t probe = 0; probe < CAPACITY; probe++)
+	{
+		Entry& entry = mEntries[(start + probe) & (CAPACITY - 1)];
+		const void* entryKey = entry.Key.load(std::memory_order_acquire);
+		if (entryKey == key)
+		{
+			return &entry;
+		}
+		if (entryKey == nullptr)
+		{
+			if (!insert)
+			{
+				return nullptr;
+			}
+			// claim the free slot, another thread may have claimed it for the same or another key meanwhile
+			if (entry.Key.compare_exchange_strong(entryKey, key, std::memory_order_acq_rel) || entryKey == key)
+			{
+				return &entry;
+			}
+		}
+	}
+
+	if (insert)
+	{
+		HTL_LOGW("Job stats table is full, " << key << " is not recorded");
+	}
+	return nullptr;
+}
+
+bool JobStats::GetSummary(const Entry& entry, Summary& summary) const
+{
+	const void* key = entry.Key.load(std::memory_order_acquire);
+	uint64_t count = entry.Count.load(std::memory_order_relaxed);
+	if (key == nullptr || count == 0)
+	{
+		return false;
+	}
+
+	const char* name = entry.Name.load(std::memory_order_relaxed);
+	summary.Name = name != nullptr ? name : "unnamed";
+	summary.Count = count;
+	summary.AverageNanoseconds = entry.TotalNanoseconds.load(std::memory_order_relaxed) / count;
+	summary.EmaNanoseconds = entry.EmaNanoseconds.load(std::memory_order_relaxed);
+	summary.P50Nanoseconds = GetPercentile(entry, 0.5);
+	summary.P90Nanoseconds = GetPercentile(entry, 0.9);
+	summary.P99Nanoseconds = GetPercentile(entry, 0.99);
+	summary.MaxNanoseconds = entry.MaxNanoseconds.load(std::memory_order_relaxed);
+	return true;
+}
+
+uint64_t JobStats::GetPercentile(const Entry& entry, double percentile) const
+{
+	// the buckets are read one by one while others may still record, so sum them up first
+	uint32_t counts[NUM_BUCKETS];
+	uint64_t total = 0;
+	for (uint32_t bucket = 0; bucket < NUM_BUCKETS; bucket++)
+	{
+		counts[bucket] = entry.Histogram[bucket].load(std::memory_order_relaxed);
+		total += counts[bucket];
+	}
+
+	// the middle of the first or last used bucket may lie outside of anything that was measured
+	uint64_t min = entry.MinNanoseconds.load(std::memory_order_relaxed);
+	uint64_t max = entry.MaxNanoseconds.load(std::memory_order_relaxed);
+	uint64_t rank = static_cast<uint64_t>(std::clamp(percentile, 0.0, 1.0) * static_cast<double>(total));
+	uint64_t seen = 0;
+	for (uint32_t bucket = 0; bucket < NUM_BUCKETS; bucket++)
+	{
+		seen += counts[bucket];
+		if (seen > rank)
+		{
+			// a sample still being recorded may not have updated min or max yet
+			return min <= max ? std::clamp(GetBucketValue(bucket), min, max) : GetBucketValue(bucket);
+		}
+	}
+	return max;
+}
+
+uint32_t JobStats::GetBucket(uint64_t nanoseconds)
+{
+	// below 16ns every value has its own bucket, above the top 5 bits of the value select the bucket
+	// e.g. 1000ns = 0b1111101000: highest bit 9, next four bits 1111 -> bucket (9 - 3) * 16 + 15
+	uint32_t numBits = static_cast<uint32_t>(std::bit_width(nanoseconds));
+	if (numBits <= SUB_BUCKET_BITS)
+	{
+		return static_cast<uint32_t>(nanoseconds);
+	}
+	uint32_t shift = numBits - 1 - SUB_BUCKET_BITS;
+	uint32_t subBucket = static_cast<uint32_t>(nanoseconds >> shift) - NUM_SUB_BUCKETS;
+	return std::min((shift + 1) * NUM_SUB_BUCKETS + subBucket, NUM_BUCKETS - 1);
+}
+
+uint64_t JobStats::GetBucketValue(uint32_t bucket)
+{
+	if (bucket < NUM_SUB_BUCKETS)
+	{
+		return bucket;
+	}
+	uint32_t shift = bucket / NUM_SUB_BUCKETS - 1;
+	uint64_t lower = static_cast<uint64_t>(NUM_SUB_BUCKETS + bucket % NUM_SUB_BUCKETS) << shift;
+	uint64_t upper = lower + (uint64_t(1) << shift);
+	return lower + (upper - lower) / 2;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// general information
+// ===================
+// - Execution time history per kind of job, Job::Execute records every run if HTL_JOB_STATS is defined
+// - Keyed by JobFunction::GetKey(): a plain function is one kind of job, so is every lambda expression.
+//      Jobs don't need to keep their names for it, JobSystem::CreateJob and JobGraph::Submit register
+//      the name of a key once for printing, keys without a name show up as "unnamed"
+// - Lock free: a fixed open addressing table, a new key claims its slot with one CAS and is never removed.
+//      Recording is a few relaxed atomic adds plus short CAS loops for the moving average and the maximum
+// - Per key: number of runs, total time, exponential moving average, minimum, maximum and a histogram with
+//      16 buckets per power of two, so percentiles are within ~3% of the real value and never outside [min, max]
+// - Samples of new keys are dropped once the table is full
+// - The measured time of a job includes the jobs it executes itself while waiting in WaitFor
+
+class JobStats
+{
+public:
+	struct Summary
+	{
+		const char* Name;
+		uint64_t Count;
+		uint64_t AverageNanoseconds;
+		uint64_t EmaNanoseconds;
+		uint64_t P50Nanoseconds;
+		uint64_t P90Nanoseconds;
+		uint64_t P99Nanoseconds;
+		uint64_t MaxNanoseconds;
+	};
+
+	JobStats();
+	~JobStats();
+
+	JobStats(const JobStats&) = delete;
+	JobStats& operator=(const JobStats&) = delete;
+
+	// may be called from any thread
+	void Record(const void* key, uint64_t nanoseconds);
+	// only the first name given for a key is kept, it has to be a string literal
+	// after that it is a lookup without any writes, so calling it for every new job is fine
+	void SetName(const void* key, const char* name);
+
+	// all getters return false if nothing was recorded for the key yet, may be called from any thread
+	// the moving average follows changes within a few dozen runs, use it for scheduling decisions
+	bool GetEma(const void* key, uint64_t& nanoseconds) const;
+	// percentile in [0, 1], e.g. 0.99
+	bool GetPercentile(const void* key, double percentile, uint64_t& nanoseconds) const;
+	bool GetSummary(const void* key, Summary& summary) const;
+
+	// snapshot of every recorded kind of job
+	std::vector<Summary> GetSummaries() const;
+
+	// one line per kind of job: name,count,average_ns,ema_ns,p50_ns,p90_ns,p99_ns,max_ns
+	bool WriteCsv(const std::string& path) const;
+	void Print() const;
+
+private:
+	// 16 buckets per power of two, up to 2^40 ns (~18 minutes), longer runs land in the last bucket
+	static const uint32_t SUB_BUCKET_BITS = 4;
+	static const uint32_t NUM_SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+	static const uint32_t NUM_BUCKETS = 40 * NUM_SUB_BUCKETS;
+
+	// power of two, more kinds of jobs than this are not recorded
+	static const uint32_t CAPACITY = 256;
+
+	// weight of a new sample in the moving average is 1 / 2^EMA_SHIFT
+	static const uint32_t EMA_SHIFT = 3;
+
+	// own cache line per entry, different kinds of jobs finish on different workers at the same time
+	struct alignas(64) Entry
+	{
+		std::atomic<const void*> Key{ nullptr };
+		std::atomic<const char*> Name{ nullptr };
+		std::atomic_uint64_t Count{ 0 };
+		std::atomic_uint64_t TotalNanoseconds{ 0 };
+		// 0 until the first sample arrived
+		std::atomic_uint64_t EmaNanoseconds{ 0 };
+		std::atomic_uint64_t MinNanoseconds{ UINT64_MAX };
+		std::atomic_uint64_t MaxNanoseconds{ 0 };
+		std::atomic_uint32_t Histogram[NUM_BUCKETS]{};
+	};
+
+	// returns nullptr if the key is unknown and insert is false, or if the table is full
+	Entry* Find(const void* key, bool insert) const;
+	bool GetSummary(const Entry& entry, Summary& summary) const;
+	uint64_t GetPercentile(const Entry& entry, double percentile) const;
+
+	static uint32_t GetBucket(uint64_t nanoseconds);
+	// middle of the range a bucket covers
+	static uint64_t GetBucketValue(uint32_t bucket);
+
+	Entry* mEntries;
+};
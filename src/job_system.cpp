@@ -1,14 +1,147 @@
 #include "job_system.h"
 
-JobSystem::JobSystem(uint32_t numThreads)
-	: mCurrentWorkerId(0)
+#include <algorithm>
+#include <bit>
+
+#ifdef __linux__
+	#include <sched.h>
+#endif
+
+JobSystem::JobSystem(uint32_t numThreads, AffinityPolicy affinityPolicy, size_t jobArenaBlockSize)
+	: mInjectionQueue(INJECTION_QUEUE_CAPACITY)
 	, mNumWorkers(numThreads)
 	, mWorkers(new JobWorker[numThreads])
+	, mIdleSpinIterations(IdleSettings().SpinIterations)
+	, mIdleYieldIterations(IdleSettings().YieldIterations)
+	, mIdleAdaptive(IdleSettings().Adaptive)
+	, mStealLastVictimFirst(StealSettings().LastVictimFirst)
+	, mStealNumProbes(StealSettings().NumProbes)
+	, mStealHalf(StealSettings().StealHalf)
+{
+	SetupWorkers(affinityPolicy);
+	uint32_t numNodes = static_cast<uint32_t>(std::max<size_t>(mTopology.GetNumaNodes().size(), 1));
+	uint32_t nodeBits = 0;
+	while ((1u << nodeBits) < numNodes)
+	{
+		nodeBits++;
+	}
+	mJobPoolIndexShift = JobHandle::INDEX_BITS - nodeBits;
+	for (uint32_t i = 0; i < numNodes; i++)
+	{
+		mJobArenas.emplace_back(new JobArena(jobArenaBlockSize));
+		mJobPools.emplace_back(new JobPool(i << mJobPoolIndexShift, 1u << mJobPoolIndexShift));
+	}
+
+	mNumSleepingWorkerWords = (mNumWorkers + 63) / 64;
+	mSleepingWorkers.reset(new std::atomic_uint64_t[mNumSleepingWorkerWords]);
+	for (uint32_t i = 0; i < mNumSleepingWorkerWords; i++)
+	{
+		mSleepingWorkers[i].store(0, std::memory_order_relaxed);
+	}
+
+#ifdef HTL_FIBERS
+	mFiberPool.reset(new FiberPool(mNumWorkers * NUM_FIBERS_PER_WORKER, FIBER_STACK_SIZE, &JobWorker::RunFiber));
+#endif
+
+	// workers only start looking for jobs once they know their job system, so everything has to be set up before
+	for (uint32_t i = 0; i < mNumWorkers; i++)
+	{
+		mWorkers[i].SetJobSystem(this);
+	}
+}
+
+void JobSystem::SetupWorkers(AffinityPolicy affinityPolicy)
 {
+	mTopology.Detect();
+	mTopology.Print();
+
+	std::vector<uint32_t> placement = mTopology.GetPlacement(affinityPolicy);
+	if (placement.empty())
+	{
+		// without pinning we don't know where a worker runs, so every victim is as good as any other
+		HTL_LOG("Workers are not pinned to cpus");
+		for (uint32_t i = 0; i < mNumWorkers; i++)
+		{
+			std::vector<uint32_t> victims;
+			for (uint32_t other = 0; other < mNumWorkers; other++)
+			{
+				if (other != i) victims.push_back(other);
+			}
+			mWorkers[i].SetVictims(JobWorker::StealTier::Remote, victims);
+		}
+		return;
+	}
+	if (placement.size() < mNumWorkers)
+	{
+		HTL_LOGW("More workers than usable cpus, " << mNumWorkers - placement.size() << " workers share a cpu");
+	}
+
+	const std::vector<uint32_t>& nodes = mTopology.GetNumaNodes();
+	std::vector<const CpuTopology::LogicalCpu*> cpus(mNumWorkers);
+	for (uint32_t i = 0; i < mNumWorkers; i++)
+	{
+		uint32_t cpuId = placement[i % placement.size()];
+		cpus[i] = mTopology.FindCpu(cpuId);
+		mWorkers[i].SetThreadAffinity(cpuId);
+		mWorkers[i].SetNumaNode(static_cast<uint32_t>(std::find(nodes.begin(), nodes.end(), cpus[i]->NumaNode) - nodes.begin()));
+	}
+
 	for (uint32_t i = 0; i < mNumWorkers; i++)
 	{
-		mWorkers[i].JobSystem = this;
+		std::vector<uint32_t> victims[JobWorker::NUM_STEAL_TIERS];
+		for (uint32_t other = 0; other < mNumWorkers; other++)
+		{
+			if (other == i) continue;
+
+			JobWorker::StealTier tier = JobWorker::StealTier::Remote;
+			if (cpus[other]->NumaNode == cpus[i]->NumaNode)
+			{
+				tier = cpus[other]->L3Group == cpus[i]->L3Group ? JobWorker::StealTier::SameCache : JobWorker::StealTier::SameNode;
+			}
+			victims[static_cast<uint32_t>(tier)].push_back(other);
+		}
+		for (uint32_t tier = 0; tier < JobWorker::NUM_STEAL_TIERS; tier++)
+		{
+			mWorkers[i].SetVictims(static_cast<JobWorker::StealTier>(tier), victims[tier]);
+		}
+		HTL_LOGD("Worker " << i << " on cpu " << cpus[i]->Id << " (node " << cpus[i]->NumaNode << ") has " << victims[0].size()
+			<< " victims sharing its L3, " << victims[1].size() << " in its node and " << victims[2].size() << " remote");
 	}
+	HTL_LOG("Pinned " << mNumWorkers << " workers with " << CpuTopology::ToString(affinityPolicy) << " placement on " << nodes.size() << " NUMA nodes");
+}
+
+size_t JobSystem::GetNumaNodeIndex()
+{
+	JobWorker* worker = JobWorker::GetCurrentWorker();
+	if (worker != nullptr && worker->GetJobSystem() == this)
+	{
+		return worker->GetNumaNode();
+	}
+
+#ifdef __linux__
+	// other threads may run anywhere, ask where we are right now
+	if (mJobArenas.size() > 1)
+	{
+		int cpuId = sched_getcpu();
+		const CpuTopology::LogicalCpu* cpu = cpuId >= 0 ? mTopology.FindCpu(static_cast<uint32_t>(cpuId)) : nullptr;
+		if (cpu != nullptr)
+		{
+			const std::vector<uint32_t>& nodes = mTopology.GetNumaNodes();
+			return std::find(nodes.begin(), nodes.end(), cpu->NumaNode) - nodes.begin();
+		}
+	}
+#endif
+	return 0;
+}
+
+JobArena& JobSystem::GetJobArena()
+{
+	return *mJobArenas[GetNumaNodeIndex()];
+}
+
+JobPool& JobSystem::GetJobPool()
+{
+	return *mJobPools[GetNumaNodeIndex()];
 }
 
 JobSystem::~JobSystem()
@@ -16,25 +149,479 @@ JobSystem::~JobSystem()
 	delete[] mWorkers;
 }
 
-void JobSystem::AddJob(Job* job)
+JobHandle JobSystem::CreateJob(const JobFunction& function, const char* name, std::initializer_list<JobHandle> dependants, JobPriority priority)
 {
-	mWorkers[mCurrentWorkerId].AddJob(job);
-	// circle through workers
-	mCurrentWorkerId = (++mCurrentWorkerId) % mNumWorkers;
+#ifdef HTL_JOB_STATS
+	// the job itself may not keep its name, the stats know it by its function
+	mJobStats.SetName(function.GetKey(), name);
+#endif
+	JobPool& jobPool = GetJobPool();
+	Job* job = nullptr;
+	if (dependants.size() == 0)
+	{
+		return jobPool.Create(job, function, name, priority);
+	}
+
+	// stale dependants are left out, they can't run anymore anyway
+	Job** dependantArray = GetJobArena().CreateArray<Job*>(dependants.size());
+	uint32_t numDependants = 0;
+	for (JobHandle dependant : dependants)
+	{
+		Job* dependantJob = GetJob(dependant);
+		if (dependantJob == nullptr)
+		{
+			HTL_LOGE("Dependant of job " << name << " was already reset");
+			continue;
+		}
+		dependantArray[numDependants++] = dependantJob;
+	}
+	return jobPool.Create(job, function, name, dependantArray, numDependants, priority);
 }
 
-bool JobSystem::AllJobsFinished() const
+JobHandle JobSystem::CreateJob(const JobFunction& function, const char* name, JobCounter& counter, std::initializer_list<JobHandle> dependants, JobPriority priority)
 {
-	for (uint32_t i = 0; i < mNumWorkers; i++)
+	JobHandle handle = CreateJob(function, name, dependants, priority);
+	if (Job* job = GetJob(handle))
 	{
-		if (!mWorkers[i].AllJobsFinished())
+		// nobody else knows the job yet, so it can't finish before it is counted
+		counter.Add(1);
+		job->SetCounter(&counter);
+	}
+	return handle;
+}
+
+Job* JobSystem::GetJob(JobHandle handle) const
+{
+	uint32_t pool = handle.GetIndex() >> mJobPoolIndexShift;
+	return pool < mJobPools.size() ? mJobPools[pool]->Get(handle) : nullptr;
+}
+
+bool JobSystem::IsFinished(JobHandle handle) const
+{
+	Job* job = GetJob(handle);
+	return job == nullptr || job->IsFinished();
+}
+
+JobHandle JobSystem::Then(JobHandle parent, const JobFunction& function, const char* name, JobPriority priority)
+{
+	JobHandle continuation = CreateJob(function, name, {}, priority);
+	AttachContinuation(continuation, &parent, 1);
+	return continuation;
+}
+
+void JobSystem::Then(JobHandle parent, JobHandle continuation)
+{
+	AttachContinuation(continuation, &parent, 1);
+}
+
+JobHandle JobSystem::WhenAll(std::initializer_list<JobHandle> parents, const JobFunction& function, const char* name, JobPriority priority)
+{
+	JobHandle continuation = CreateJob(function, name, {}, priority);
+	AttachContinuation(continuation, parents.begin(), parents.size());
+	return continuation;
+}
+
+void JobSystem::WhenAll(std::initializer_list<JobHandle> parents, JobHandle continuation)
+{
+	AttachContinuation(continuation, parents.begin(), parents.size());
+}
+
+void JobSystem::AttachContinuation(JobHandle continuationHandle, const JobHandle* parents, size_t numParents)
+{
+	Job* continuation = GetJob(continuationHandle);
+	if (continuation == nullptr)
+	{
+		HTL_LOGE("Can't attach a continuation that was already reset");
+		return;
+	}
+
+	if (LinkContinuation(continuation, parents, numParents))
+	{
+		HTL_LOGD("All parents of " << continuation->GetName() << " already finished, scheduling it right away");
+		Schedule(continuation);
+	}
+}
+
+bool JobSystem::LinkContinuation(Job* continuation, const JobHandle* parents, size_t numParents)
+{
+	// hold one extra dependency while attaching, otherwise the first parent could finish
+	// and schedule the continuation before we attached it to the second one
+	continuation->AddDependency();
+
+	for (size_t i = 0; i < numParents; i++)
+	{
+		// a parent that was already reset is long finished
+		Job* parent = GetJob(parents[i]);
+		if (parent != nullptr)
+		{
+			LinkContinuation(continuation, parent);
+		}
+	}
+
+	return continuation->ResolveDependency();
+}
+
+bool JobSystem::LinkContinuation(Job* continuation, Job* parent)
+{
+	continuation->AddDependency();
+	// links are only touched by the attaching and the finishing thread, no need for a cache line each
+	JobContinuation* link = GetJobArena().CreateArray<JobContinuation>(1);
+	link->Dependant = continuation;
+	// parent already finished, nothing to wait for
+	return !parent->AddContinuation(link) && continuation->ResolveDependency();
+}
+
+bool JobSystem::LinkContinuation(Job* continuation, JobCounter& counter, int32_t target)
+{
+	continuation->AddDependency();
+	JobCounterWaiter* waiter = GetJobArena().CreateArray<JobCounterWaiter>(1);
+	waiter->Dependant = continuation;
+	waiter->Target = target;
+	// target already reached, nothing to wait for
+	return !counter.AddWaiter(waiter) && continuation->ResolveDependency();
+}
+
+JobHandle JobSystem::CreateTask(JobTask&& task, const char* name, JobPriority priority)
+{
+	std::coroutine_handle<> coroutine = task.Release();
+	JobHandle job = CreateJob([coroutine]() { coroutine.resume(); }, name, {}, priority);
+	if (!job.IsValid())
+	{
+		coroutine.destroy();
+	}
+	return job;
+}
+
+JobAwaiter JobSystem::Await(JobHandle job)
+{
+	return JobAwaiter(*this, job);
+}
+
+JobAwaiter JobSystem::Await(std::initializer_list<JobHandle> jobs)
+{
+	return JobAwaiter(*this, jobs.begin(), jobs.size());
+}
+
+JobAwaiter JobSystem::Await(const JobHandle* jobs, size_t numJobs)
+{
+	return JobAwaiter(*this, jobs, numJobs);
+}
+
+JobAwaiter JobSystem::Await(JobCounter& counter, int32_t target)
+{
+	return JobAwaiter(*this, counter, target);
+}
+
+bool JobSystem::SuspendCurrentJob(const JobHandle* jobs, size_t numJobs)
+{
+	Job* current = Job::GetCurrentJob();
+	if (current == nullptr)
+	{
+		HTL_LOGW("Awaiting jobs outside of a job, blocking instead");
+		for (size_t i = 0; i < numJobs; i++)
 		{
-			return false;
+			WaitFor(jobs[i]);
 		}
+		return false;
 	}
+
+	if (LinkContinuation(current, jobs, numJobs))
+	{
+		return false;
+	}
+	// from here on the last job we wait for may already run us again on another worker
+	Job::SuspendCurrentJob(true);
 	return true;
 }
 
+bool JobSystem::SuspendCurrentJob(JobCounter& counter, int32_t target)
+{
+	Job* current = Job::GetCurrentJob();
+	if (current == nullptr)
+	{
+		HTL_LOGW("Awaiting a counter outside of a job, blocking instead");
+		WaitForCounter(counter, target);
+		return false;
+	}
+
+	if (LinkContinuation(current, counter, target))
+	{
+		return false;
+	}
+	// the job taking the counter to the target runs us again
+	Job::SuspendCurrentJob(true);
+	return true;
+}
+
+void* JobSystem::AllocateCoroutineFrame(size_t size)
+{
+	return GetJobArena().Allocate(size);
+}
+
+#ifdef HTL_FIBERS
+FiberPool& JobSystem::GetFiberPool()
+{
+	return *mFiberPool;
+}
+
+bool JobSystem::ParkUntilFinished(JobWorker& worker, Job* job)
+{
+	Job* resume = CreateResumeJob(worker);
+	if (resume == nullptr)
+	{
+		return false;
+	}
+
+	// if it finished meanwhile, the resume job never runs and is just dropped with the next ResetJobs
+	if (!LinkContinuation(resume, job))
+	{
+		worker.ParkCurrentFiber();
+	}
+	return true;
+}
+
+bool JobSystem::ParkUntilReached(JobWorker& worker, JobCounter& counter, int32_t target)
+{
+	Job* resume = CreateResumeJob(worker);
+	if (resume == nullptr)
+	{
+		return false;
+	}
+
+	if (!LinkContinuation(resume, counter, target))
+	{
+		worker.ParkCurrentFiber();
+	}
+	return true;
+}
+
+Job* JobSystem::CreateResumeJob(JobWorker& worker)
+{
+	// the worker finishing the awaited job runs this right away, it hands the fiber back to the worker that parked it,
+	// thread locals don't survive a move to another thread
+	JobWorker* owner = &worker;
+	Fiber* fiber = worker.GetCurrentFiber();
+	return GetJob(CreateJob([owner, fiber]() { owner->ResumeFiber(fiber); }, "resume fiber", {}, JobPriority::Critical));
+}
+#endif
+
+void JobSystem::ResetJobs()
+{
+	HTL_LOGD("Resetting job arenas...");
+	for (std::unique_ptr<JobArena>& jobArena : mJobArenas)
+	{
+		jobArena->Reset();
+	}
+	for (std::unique_ptr<JobPool>& jobPool : mJobPools)
+	{
+		jobPool->ReleaseAll();
+	}
+}
+
+void JobSystem::AddJob(JobHandle handle)
+{
+	Job* job = GetJob(handle);
+	if (job == nullptr)
+	{
+		HTL_LOGE("Can't add a job that was already reset");
+		return;
+	}
+	AddJob(job);
+}
+
+void JobSystem::AddJob(Job* job)
+{
+	if (job->HasDependencies())
+	{
+		HTL_LOGD("Job " << job->GetName() << " will be scheduled when its dependencies are finished");
+		return;
+	}
+	Schedule(job);
+}
+
+void JobSystem::Schedule(Job* job, bool wakeWorker)
+{
+	// only the owner may push to a worker deque
+	JobWorker* worker = JobWorker::GetCurrentWorker();
+	if (worker != nullptr && worker->GetJobSystem() == this)
+	{
+		worker->AddJob(job);
+		if (wakeWorker)
+		{
+			WakeIdleWorker();
+		}
+		return;
+	}
+
+	// other threads don't pick up injected jobs on their own, so always wake someone
+
+	while (!mInjectionQueue.Push(job))
+	{
+		HTL_LOGW("Injection queue is full, waiting for workers to catch up...");
+		std::this_thread::yield();
+	}
+	HTL_LOGD("Injected job " << job->GetName());
+	WakeIdleWorker();
+}
+
+size_t JobSystem::TakeInjectedJobs(Job** jobs, size_t maxCount)
+{
+	return mInjectionQueue.PopBatch(jobs, maxCount);
+}
+
+bool JobSystem::HasInjectedJobs() const
+{
+	return !mInjectionQueue.Empty();
+}
+
+size_t JobSystem::GetNumInjectedJobs() const
+{
+	return mInjectionQueue.Size();
+}
+
+template <typename Condition>
+void JobSystem::HelpUntil(JobWorker* worker, const Condition& isDone)
+{
+	// instead of busy waiting, we help by executing other jobs
+	while (!isDone())
+	{
+		Job* otherJob = worker != nullptr ? worker->GetJob() : GetJobForHelper();
+		if (otherJob == nullptr)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		// follow the handed over dependants as long as we are still waiting
+		while (otherJob != nullptr)
+		{
+			HTL_LOGD("Helping with job " << otherJob->GetName() << " while waiting");
+			otherJob = otherJob->Execute(*this);
+			if (otherJob != nullptr && isDone())
+			{
+				// done waiting, someone else continues the chain
+				Schedule(otherJob);
+				otherJob = nullptr;
+			}
+		}
+	}
+}
+
+void JobSystem::WaitFor(JobHandle handle)
+{
+	// a job that was already reset is finished, its slot may belong to a new job by now
+	Job* job = GetJob(handle);
+	if (job != nullptr)
+	{
+		WaitFor(job);
+	}
+}
+
+void JobSystem::WaitFor(Job* job)
+{
+	JobWorker* worker = JobWorker::GetCurrentWorker();
+	if (worker != nullptr && worker->GetJobSystem() != this)
+	{
+		worker = nullptr;
+	}
+
+#ifdef HTL_FIBERS
+	if (worker != nullptr && worker->GetCurrentFiber() != nullptr && !job->IsFinished() && ParkUntilFinished(*worker, job))
+	{
+		return;
+	}
+#endif
+
+	HelpUntil(worker, [job]() { return job->IsFinished(); });
+}
+
+void JobSystem::WaitForCounter(JobCounter& counter, int32_t target)
+{
+	JobWorker* worker = JobWorker::GetCurrentWorker();
+	if (worker != nullptr && worker->GetJobSystem() != this)
+	{
+		worker = nullptr;
+	}
+
+#ifdef HTL_FIBERS
+	if (worker != nullptr && worker->GetCurrentFiber() != nullptr && !counter.HasReached(target) && ParkUntilReached(*worker, counter, target))
+	{
+		// the counter may live on our stack
+		counter.WaitWhileDecrementing();
+		return;
+	}
+#endif
+
+	HelpUntil(worker, [&counter, target]() { return counter.HasReached(target); });
+}
+
+
+Job* JobSystem::GetJobForHelper()
+{
+	Job* job = nullptr;
+	if (TakeInjectedJobs(&job, 1) > 0)
+	{
+		return job;
+	}
+
+	// no own id to exclude, so every worker is a possible victim
+	unsigned int randomNumber = GetRandomWorkerThreadId(mNumWorkers);
+	return mWorkers[randomNumber].StealJob();
+}
+
+bool JobSystem::ShouldSplitRange() const
+{
+	JobWorker* worker = JobWorker::GetCurrentWorker();
+	if (worker != nullptr && worker->GetJobSystem() == this)
+	{
+		return worker->GetNumJobs() == 0;
+	}
+	// splits of other threads go through the injection queue
+	return !HasInjectedJobs();
+}
+
+JobStats& JobSystem::GetJobStats()
+{
+	return mJobStats;
+}
+
+JobStats& JobSystem::GetParallelForStats()
+{
+	return mParallelForStats;
+}
+
+void JobSystem::SetIdleSettings(const IdleSettings& settings)
+{
+	mIdleSpinIterations.store(settings.SpinIterations, std::memory_order_relaxed);
+	mIdleYieldIterations.store(settings.YieldIterations, std::memory_order_relaxed);
+	mIdleAdaptive.store(settings.Adaptive, std::memory_order_relaxed);
+}
+
+IdleSettings JobSystem::GetIdleSettings() const
+{
+	IdleSettings settings;
+	settings.SpinIterations = mIdleSpinIterations.load(std::memory_order_relaxed);
+	settings.YieldIterations = mIdleYieldIterations.load(std::memory_order_relaxed);
+	settings.Adaptive = mIdleAdaptive.load(std::memory_order_relaxed);
+	return settings;
+}
+
+void JobSystem::SetStealSettings(const StealSettings& settings)
+{
+	mStealLastVictimFirst.store(settings.LastVictimFirst, std::memory_order_relaxed);
+	mStealNumProbes.store(settings.NumProbes, std::memory_order_relaxed);
+	mStealHalf.store(settings.StealHalf, std::memory_order_relaxed);
+}
+
+StealSettings JobSystem::GetStealSettings() const
+{
+	StealSettings settings;
+	settings.LastVictimFirst = mStealLastVictimFirst.load(std::memory_order_relaxed);
+	settings.NumProbes = mStealNumProbes.load(std::memory_order_relaxed);
+	settings.StealHalf = mStealHalf.load(std::memory_order_relaxed);
+	return settings;
+}
+
 void JobSystem::ShutDown()
 {
 	HTL_LOGD("Shutting down jobsystem...");
@@ -42,29 +629,77 @@ void JobSystem::ShutDown()
 	{
 		mWorkers[i].Shutdown();
 	}
+
+	// drop jobs nobody picked up anymore, so no one waits for them
+	while (mInjectionQueue.Pop() != nullptr);
 };
 
-// iterate all workers and wake them up if dependencies were resolved
-void JobSystem::WakeThreads()
+// wake up one sleeping worker, picked from the sleeper bits, so with nobody sleeping this is a single load
+// starting after the calling worker spreads the wake ups, and the caller itself is awake anyway
+void JobSystem::WakeIdleWorker()
 {
-	HTL_LOGD("Trying to wake up threads...");
-	for (uint32_t i = 0; i < mNumWorkers; i++)
+	JobWorker* current = JobWorker::GetCurrentWorker();
+	uint32_t first = 0;
+	if (current != nullptr && current->GetJobSystem() == this)
 	{
-		mWorkers[i].WakeUp();
+		// the job went to our own deque and we run it anyway, a sleeper missing it only costs parallelism
+		// (a parking worker only checks its own deque), so no fence on this path
+		first = static_cast<uint32_t>(current - mWorkers) + 1;
+	}
+	else
+	{
+		// nobody but a woken worker picks up an injected job, pairs with the fence in EventCount::PrepareWait
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+
+	// a picked worker may just be waking up on its own, then we try the next one, but not forever
+	uint32_t attempts = 0;
+	for (uint32_t i = 0; i < mNumSleepingWorkerWords; i++)
+	{
+		uint32_t word = (first / 64 + i) % mNumSleepingWorkerWords;
+		uint64_t sleepers = mSleepingWorkers[word].load(std::memory_order_relaxed);
+		while (sleepers != 0 && attempts < mNumWorkers)
+		{
+			uint64_t preferred = i == 0 ? sleepers & (~uint64_t(0) << (first % 64)) : 0;
+			uint32_t bit = static_cast<uint32_t>(std::countr_zero(preferred != 0 ? preferred : sleepers));
+			uint64_t mask = uint64_t(1) << bit;
+			attempts++;
+			// clearing the bit claims the sleeper, so two producers don't both wake the same worker
+			// if it isn't waiting yet the claim fails, the worker joins again after PrepareWait (see JobWorker::WaitForJob)
+			if ((mSleepingWorkers[word].fetch_and(~mask, std::memory_order_acq_rel) & mask) != 0 && mWorkers[word * 64 + bit].WakeUpIfWaiting())
+			{
+				return;
+			}
+			sleepers = mSleepingWorkers[word].load(std::memory_order_relaxed);
+		}
 	}
-	HTL_LOGD("No thread was worthy to wake up... ");
 }
 
-// return a random worker thread id, excluding the one given
+void JobSystem::AddSleepingWorker(const JobWorker& worker)
+{
+	uint32_t index = static_cast<uint32_t>(&worker - mWorkers);
+	mSleepingWorkers[index / 64].fetch_or(uint64_t(1) << (index % 64));
+}
+
+void JobSystem::RemoveSleepingWorker(const JobWorker& worker)
+{
+	uint32_t index = static_cast<uint32_t>(&worker - mWorkers);
+	mSleepingWorkers[index / 64].fetch_and(~(uint64_t(1) << (index % 64)), std::memory_order_relaxed);
+}
+
+// return a random worker thread id, excluding the one given (pass GetNumWorkers() to exclude no one)
+// may be called from any thread, every thread uses its own generator
 unsigned int JobSystem::GetRandomWorkerThreadId(unsigned int threadId)
 {
-	unsigned int randomNumber = mRanNumGen.Rand(0, mNumWorkers);
-	if (threadId == randomNumber)
+	static thread_local Random random;
+	if (threadId >= mNumWorkers || mNumWorkers < 2)
 	{
-		// return the following id instead, to prevent stealing from the given (own) thread
-		randomNumber = (randomNumber + 1) % mNumWorkers;
+		return random.Rand(0, mNumWorkers);
 	}
-	return randomNumber;
+
+	// draw from the other workers only and skip over the excluded one, so all of them are equally likely
+	unsigned int randomNumber = random.Rand(0, mNumWorkers - 1);
+	return randomNumber >= threadId ? randomNumber + 1 : randomNumber;
 }
 
 uint32_t JobSystem::GetNumWorkers() const
@@ -75,4 +710,9 @@ uint32_t JobSystem::GetNumWorkers() const
 JobWorker* JobSystem::GetWorkers()
 {
 	return mWorkers;
+}
+
+const CpuTopology& JobSystem::GetTopology() const
+{
+	return mTopology;
 }
\ No newline at end of file
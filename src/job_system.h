@@ -1,30 +1,342 @@
 #pragma once
 
+#include "cpu_topology.h"
+#include "injection_queue.h"
+#include "job_arena.h"
+#include "job_counter.h"
+#include "job_pool.h"
+#include "job_stats.h"
+#include "job_task.h"
 #include "job_worker.h"
-#include "random.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <initializer_list>
+#include <memory>
+#include <typeinfo>
+#include <vector>
 
 class JobSystem
 {
 public:
-	JobSystem(uint32_t numThreads);
+	// workers get pinned to cpus in the order given by the affinity policy
+	JobSystem(uint32_t numThreads, AffinityPolicy affinityPolicy = AffinityPolicy::Compact, size_t jobArenaBlockSize = DEFAULT_JOB_ARENA_BLOCK_SIZE);
 	~JobSystem();
 
+	// jobs live in the job pool of the calling thread's NUMA node until ResetJobs() is called, no need to delete them
+	// function may be any small callable, e.g. a lambda, { &Class::Method, object } or { function, data }
+	// returns an invalid handle if the pool is full, may be called from any thread
+	JobHandle CreateJob(const JobFunction& function, const char* name, std::initializer_list<JobHandle> dependants = {}, JobPriority priority = JobPriority::Normal);
+	// counted in counter until it finishes, see WaitForCounter
+	JobHandle CreateJob(const JobFunction& function, const char* name, JobCounter& counter, std::initializer_list<JobHandle> dependants = {}, JobPriority priority = JobPriority::Normal);
+
+	// nullptr once the job was reset, a stale handle never reaches the job that reuses its slot
+	// the pointer is only valid until the next ResetJobs()
+	Job* GetJob(JobHandle handle) const;
+	// jobs that were already reset count as finished
+	bool IsFinished(JobHandle handle) const;
+
+	// continuation that runs after parent, building the graph forward instead of listing dependants up front
+	// the parent may already be scheduled, running or even finished (then the continuation is scheduled right away)
+	// a ready continuation runs on the thread that finished its last parent, without going through a queue
+	// the continuation itself must not be added with AddJob, it is scheduled by its parents
+	// may be called from any thread, the links to the parents live in the job arena like the jobs
+	JobHandle Then(JobHandle parent, const JobFunction& function, const char* name, JobPriority priority = JobPriority::Normal);
+	void Then(JobHandle parent, JobHandle continuation);
+
+	// continuation that runs after all parents, same rules as Then()
+	JobHandle WhenAll(std::initializer_list<JobHandle> parents, const JobFunction& function, const char* name, JobPriority priority = JobPriority::Normal);
+	void WhenAll(std::initializer_list<JobHandle> parents, JobHandle continuation);
+
+	// coroutine job, it starts running once the job is added and finishes when the coroutine returns, see job_task.h
+	// returns an invalid handle if the pool is full, may be called from any thread
+	JobHandle CreateTask(JobTask&& task, const char* name, JobPriority priority = JobPriority::Normal);
+
+	// co_await the result from within a JobTask, the task resumes on the worker finishing the last of the jobs
+	JobAwaiter Await(JobHandle job);
+	JobAwaiter Await(std::initializer_list<JobHandle> jobs);
+	// e.g. all jobs of a std::vector, the array has to live until the co_await is resumed
+	JobAwaiter Await(const JobHandle* jobs, size_t numJobs);
+	// resumes once the counter is at or below target
+	JobAwaiter Await(JobCounter& counter, int32_t target = 0);
+
+	// frees all created jobs of all nodes at once, only call if all of them are finished
+	// every handle handed out so far turns stale, the pool slots are reused by the next jobs
+	void ResetJobs();
+
+	// may be called from any thread, jobs with dependencies are ignored
+	// because they get scheduled by their last dependency
+	void AddJob(JobHandle job);
+	// for jobs the caller owns itself, e.g. the jobs of a JobGraph
 	void AddJob(Job* job);
-	bool AllJobsFinished() const;
+
+	// push a job without open dependencies, workers push to their own deque
+	// and all other threads submit through the injection queue
+	// a worker that picks up the job itself right after can skip waking another worker
+	void Schedule(Job* job, bool wakeWorker = true);
+
+	// returns when the job is finished, meanwhile the calling thread helps executing other jobs
+	// with HTL_FIBERS a job on a worker parks its fiber instead and the worker goes on with other jobs
+	// may be called from any thread, also from within a job
+	void WaitFor(JobHandle job);
+	void WaitFor(Job* job);
+	// returns when the counter is at or below target, e.g. all jobs of one batch are finished, helps or parks like WaitFor
+	// several threads may wait for the same counter with different targets
+	void WaitForCounter(JobCounter& counter, int32_t target = 0);
+
+	// calls function(i) for every i in [begin, end) and returns when all of them are done
+	// ranges are split lazily: a range only gives away its upper half if the own deque is empty,
+	// so thieves always steal the biggest remaining halves and busy workers don't create jobs at all
+	// grain is the smallest range that still gets split, 0 derives it from the measured cost per item
+	//     (with HTL_JOB_STATS averaged over all calls with the same function type)
+	// may be called from any thread, also from within a job, the calling thread works on the range itself
+	// split jobs live in the job arena, so they are freed with ResetJobs(), and inherit the priority of the calling job
+	template <typename Function>
+	void ParallelFor(uint32_t begin, uint32_t end, uint32_t grain, const Function& function);
+
+	// how idle workers spin, yield and park, may be changed at any time from any thread
+	void SetIdleSettings(const IdleSettings& settings);
+	IdleSettings GetIdleSettings() const;
+
+	// how workers pick their victims, may be changed at any time from any thread
+	void SetStealSettings(const StealSettings& settings);
+	StealSettings GetStealSettings() const;
+
+	// execution times per kind of job, filled by Job::Execute with HTL_JOB_STATS
+	JobStats& GetJobStats();
+	// cost per item of ParallelFor functions with automatic grain, keyed by the function type
+	JobStats& GetParallelForStats();
 
 	void ShutDown();
-	void WakeThreads();
+
+	// wake up one sleeping worker, the ones after the calling worker first
+	void WakeIdleWorker();
+
+	// used by a worker about to park, so WakeIdleWorker finds it without asking every worker
+	void AddSleepingWorker(const JobWorker& worker);
+	void RemoveSleepingWorker(const JobWorker& worker);
+
+	// used by JobAwaiter: the calling job becomes a continuation of the jobs and returns without finishing
+	// returns false if there is nothing to wait for, then the job just goes on
+	// outside of a job it can't suspend, so it waits for the jobs right here and returns false as well
+	bool SuspendCurrentJob(const JobHandle* jobs, size_t numJobs);
+	bool SuspendCurrentJob(JobCounter& counter, int32_t target);
+
+	// used by JobTask, frames live in the job arena like the jobs
+	void* AllocateCoroutineFrame(size_t size);
+
+#ifdef HTL_FIBERS
+	// fibers the workers run their job loops on, shared by all workers
+	FiberPool& GetFiberPool();
+#endif
+
+	// used by idle workers to drain the injection queue
+	size_t TakeInjectedJobs(Job** jobs, size_t maxCount);
+	bool HasInjectedJobs() const;
+	size_t GetNumInjectedJobs() const;
+
+private:
+	// pins the workers and groups them by cache and NUMA node for stealing
+	void SetupWorkers(AffinityPolicy affinityPolicy);
+
+	// index into CpuTopology::GetNumaNodes() of the node the calling thread runs on
+	size_t GetNumaNodeIndex();
+	// arena and job pool of the NUMA node the calling thread runs on
+	JobArena& GetJobArena();
+	JobPool& GetJobPool();
+
+	void AttachContinuation(JobHandle continuation, const JobHandle* parents, size_t numParents);
+	// returns true if all parents were already finished, the continuation is ready then and the caller decides what to do
+	bool LinkContinuation(Job* continuation, const JobHandle* parents, size_t numParents);
+	bool LinkContinuation(Job* continuation, Job* parent);
+	bool LinkContinuation(Job* continuation, JobCounter& counter, int32_t target);
+
+#ifdef HTL_FIBERS
+	// park the fiber of the calling job until the job is finished or the counter reached target,
+	// false if that isn't possible right now
+	bool ParkUntilFinished(JobWorker& worker, Job* job);
+	bool ParkUntilReached(JobWorker& worker, JobCounter& counter, int32_t target);
+	// job that lets the calling fiber continue on its worker, nullptr if the pool is full
+	Job* CreateResumeJob(JobWorker& worker);
+#endif
+
+	// runs other jobs on the calling thread until isDone returns true
+	template <typename Condition>
+	void HelpUntil(JobWorker* worker, const Condition& isDone);
+
+	// job for a thread without own deque, taken from the injection queue or stolen from a worker
+	Job* GetJobForHelper();
+
+	template <typename Function>
+	void ParallelForRange(uint32_t begin, uint32_t end, uint32_t grain, const Function* function);
+
+	template <typename Function>
+	uint32_t MeasureParallelForGrain(uint32_t& begin, uint32_t end, const Function& function);
+
+	// true if nobody could pick up a split right now, i.e. the calling thread's queue is empty
+	bool ShouldSplitRange() const;
+
+public:
 
 	unsigned int GetRandomWorkerThreadId(unsigned int threadId);
 	uint32_t GetNumWorkers() const;
 	JobWorker* GetWorkers();
+	const CpuTopology& GetTopology() const;
+
+	// enough for ~16k jobs per frame and NUMA node before another block has to be chained
+	static const size_t DEFAULT_JOB_ARENA_BLOCK_SIZE = 1024 * 1024;
 
 private:
-	uint32_t mCurrentWorkerId;
+	// enough for a lot of frames worth of jobs, AddJob yields if it ever runs full
+	static const size_t INJECTION_QUEUE_CAPACITY = 4096;
+
+#ifdef HTL_FIBERS
+	// enough for a few jobs per worker waiting at the same time, with none left workers wait without parking
+	static const uint32_t NUM_FIBERS_PER_WORKER = 16;
+	// stacks are reserved up front but the OS only backs the pages that were touched
+	static const size_t FIBER_STACK_SIZE = 256 * 1024;
+#endif
+
+	// a chunk should take about this long, long enough to hide the cost of a job
+	// but short enough so an idle worker doesn't wait long for the next split
+	static const int64_t PARALLEL_FOR_CHUNK_NANOSECONDS = 20000;
+	// stop measuring the cost per item after this, the measured items are not wasted
+	static const int64_t PARALLEL_FOR_PROBE_NANOSECONDS = 5000;
+
+	// needs to be constructed before the workers, as they start polling it right away
+	InjectionQueue mInjectionQueue;
+
+	CpuTopology mTopology;
+
+	JobStats mJobStats;
+	JobStats mParallelForStats;
+
+	// one arena and one job pool per NUMA node, jobs are created in the pool of the creating thread's node
+	// and their dependant arrays and continuation links in its arena
+	// blocks are only touched by the threads creating jobs in them, so the OS places their pages on that node
+	std::vector<std::unique_ptr<JobArena>> mJobArenas;
+	// the pools split the handle indices evenly, the top bits of an index select the pool
+	std::vector<std::unique_ptr<JobPool>> mJobPools;
+	uint32_t mJobPoolIndexShift;
+
+#ifdef HTL_FIBERS
+	// set up before the workers know their job system, they pick their first fiber right after
+	std::unique_ptr<FiberPool> mFiberPool;
+#endif
+
+	// one bit per parking worker, set before it checks for work a last time and cleared by whoever wakes it
+	std::unique_ptr<std::atomic_uint64_t[]> mSleepingWorkers;
+	uint32_t mNumSleepingWorkerWords;
 
 	// Use basic array instead of vector, because vector complains about deleted copy-constructor
 	JobWorker* mWorkers;
 	uint32_t mNumWorkers;
 
-	Random mRanNumGen;
-};
\ No newline at end of file
+	// read by every idle worker, so stored as separate atomics instead of a locked IdleSettings
+	std::atomic_uint32_t mIdleSpinIterations;
+	std::atomic_uint32_t mIdleYieldIterations;
+	std::atomic_bool mIdleAdaptive;
+
+	std::atomic_bool mStealLastVictimFirst;
+	std::atomic_uint32_t mStealNumProbes;
+	std::atomic_bool mStealHalf;
+};
+
+template <typename Function>
+void JobSystem::ParallelFor(uint32_t begin, uint32_t end, uint32_t grain, const Function& function)
+{
+	if (grain == 0)
+	{
+		grain = MeasureParallelForGrain(begin, end, function);
+	}
+	if (begin < end)
+	{
+		ParallelForRange(begin, end, grain, &function);
+	}
+}
+
+template <typename Function>
+void JobSystem::ParallelForRange(uint32_t begin, uint32_t end, uint32_t grain, const Function* function)
+{
+	// every split halves the range, so 32 is enough for any uint32_t range
+	Job* splits[32];
+	uint32_t numSplits = 0;
+
+	while (end - begin > grain)
+	{
+		if (ShouldSplitRange())
+		{
+			// give away the upper half, we keep working on the lower one
+			uint32_t middle = begin + (end - begin) / 2;
+			// splits never leave this call, so they are tracked by pointer
+			Job* split = GetJob(CreateJob([this, middle, end, grain, function]() { ParallelForRange(middle, end, grain, function); }, "parallel for",
+				{}, Job::GetCurrentPriority()));
+			if (split == nullptr)
+			{
+				// pool full, we work on the rest ourselves
+				break;
+			}
+			splits[numSplits++] = split;
+			Schedule(split);
+			end = middle;
+		}
+		else
+		{
+			// nobody picked up the last split yet, so just work on the next chunk
+			uint32_t chunkEnd = begin + grain;
+			for (; begin < chunkEnd; ++begin)
+			{
+				(*function)(begin);
+			}
+		}
+	}
+
+	for (; begin < end; ++begin)
+	{
+		(*function)(begin);
+	}
+
+	// the newest split is the smallest and most likely still in our own deque
+	while (numSplits > 0)
+	{
+		WaitFor(splits[--numSplits]);
+	}
+}
+
+template <typename Function>
+uint32_t JobSystem::MeasureParallelForGrain(uint32_t& begin, uint32_t end, const Function& function)
+{
+	// run a doubling number of items until the probe time is reached
+	auto start = std::chrono::high_resolution_clock::now();
+	int64_t elapsed = 0;
+	uint32_t measuredItems = 0;
+	uint32_t probeItems = 1;
+	while (begin < end && elapsed < PARALLEL_FOR_PROBE_NANOSECONDS)
+	{
+		uint32_t probeEnd = begin + std::min(probeItems, end - begin);
+		measuredItems += probeEnd - begin;
+		for (; begin < probeEnd; ++begin)
+		{
+			function(begin);
+		}
+		elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - start).count();
+		probeItems *= 2;
+	}
+
+	int64_t nanosecondsPerItem = std::max<int64_t>(elapsed / std::max<uint32_t>(measuredItems, 1), 1);
+#ifdef HTL_JOB_STATS
+	// a single probe may hit cold caches or get preempted, the average over earlier calls is steadier
+	const char* key = typeid(Function).name();
+	mParallelForStats.SetName(key, key);
+	mParallelForStats.Record(key, static_cast<uint64_t>(nanosecondsPerItem));
+	uint64_t averageNanosecondsPerItem;
+	if (mParallelForStats.GetEma(key, averageNanosecondsPerItem))
+	{
+		nanosecondsPerItem = static_cast<int64_t>(averageNanosecondsPerItem);
+	}
+#endif
+	int64_t grain = std::min<int64_t>(std::max<int64_t>(PARALLEL_FOR_CHUNK_NANOSECONDS / nanosecondsPerItem, 1), UINT32_MAX);
+	HTL_LOGD("ParallelFor measured " << nanosecondsPerItem << "ns per item, using grain " << grain);
+	return static_cast<uint32_t>(grain);
+}
\ No newline at end of file
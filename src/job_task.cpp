@@ -0,0 +1,111 @@
+#include "job_task.h"
+#include "job_system.h"
+
+#include <utility>
+
+JobTask::JobTask(std::coroutine_handle<promise_type> coroutine)
+	: mCoroutine(coroutine)
+{
+}
+
+JobTask::JobTask(JobTask&& other) noexcept
+	: mCoroutine(std::exchange(other.mCoroutine, nullptr))
+{
+}
+
+JobTask& JobTask::operator=(JobTask&& other) noexcept
+{
+	if (this != &other)
+	{
+		if (mCoroutine)
+		{
+			mCoroutine.destroy();
+		}
+		mCoroutine = std::exchange(other.mCoroutine, nullptr);
+	}
+	return *this;
+}
+
+JobTask::~JobTask()
+{
+	// never started, so nobody else will destroy the frame
+	if (mCoroutine)
+	{
+		mCoroutine.destroy();
+	}
+}
+
+std::coroutine_handle<> JobTask::Release()
+{
+	return std::exchange(mCoroutine, nullptr);
+}
+
+void* JobTask::AllocateFrame(JobSystem& jobSystem, size_t size)
+{
+	return jobSystem.AllocateCoroutineFrame(size);
+}
+
+JobAwaiter::JobAwaiter(JobSystem& jobSystem, JobHandle job)
+	: mJobSystem(jobSystem)
+	, mJob(job)
+	, mJobs(nullptr)
+	, mNumJobs(1)
+	, mCounter(nullptr)
+	, mTarget(0)
+{
+}
+
+JobAwaiter::JobAwaiter(JobSystem& jobSystem, const JobHandle* jobs, size_t numJobs)
+	: mJobSystem(jobSystem)
+	, mJobs(jobs)
+	, mNumJobs(numJobs)
+	, mCounter(nullptr)
+	, mTarget(0)
+{
+}
+
+JobAwaiter::JobAwaiter(JobSystem& jobSystem, JobCounter& counter, int32_t target)
+	: mJobSystem(jobSystem)
+	, mJobs(nullptr)
+	, mNumJobs(0)
+	, mCounter(&counter)
+	, mTarget(target)
+{
+}
+
+bool JobAwaiter::await_ready() const
+{
+	if (mCounter != nullptr)
+	{
+		return mCounter->HasReached(mTarget);
+	}
+
+	const JobHandle* jobs = mJobs != nullptr ? mJobs : &mJob;
+	for (size_t i = 0; i < mNumJobs; i++)
+	{
+		if (!mJobSystem.IsFinished(jobs[i]))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool JobAwaiter::await_suspend(std::coroutine_handle<>)
+{
+	// the coroutine is resumed by running its job again, not through the handle
+	if (mCounter != nullptr)
+	{
+		return mJobSystem.SuspendCurrentJob(*mCounter, mTarget);
+	}
+	return mJobSystem.SuspendCurrentJob(mJobs != nullptr ? mJobs : &mJob, mNumJobs);
+}
+
+void JobAwaiter::await_resume() const
+{
+	// the job that took the counter to the target may still be inside it, and the counter may go away once we return
+	if (mCounter != nullptr)
+	{
+		mCounter->WaitWhileDecrementing();
+	}
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "job_counter.h"
+#include "job_pool.h"
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <type_traits>
+
+// general information
+// ===================
+// - JobTask is the return type of a coroutine that runs as a job: it can co_await other jobs
+//      instead of blocking its worker in WaitFor
+//
+//      JobTask UpdateFrame(JobSystem& jobSystem)
+//      {
+//          JobHandle physics = jobSystem.CreateJob(&UpdatePhysics, "physics");
+//          jobSystem.AddJob(physics);
+//          co_await jobSystem.Await(physics);
+//          ...
+//      }
+//      JobHandle frame = jobSystem.CreateTask(UpdateFrame(jobSystem), "frame");
+//      jobSystem.AddJob(frame);
+//
+// - The task is one ordinary job that runs several times: every run resumes the coroutine until it
+//      suspends or returns. On co_await the job returns without finishing and becomes a continuation
+//      of the awaited jobs (see JobSystem::Then), so the worker finishing the last of them resumes it
+//      right away. The task job finishes when the coroutine returns, so it can be awaited, waited for
+//      and used as a dependency like any other job
+// - co_await jobSystem.Await(counter) waits for a whole batch of jobs instead, see job_counter.h
+// - Coroutine frames are allocated in the job arena, so the coroutine needs the JobSystem as one of its
+//      parameters (by reference or pointer). Like the jobs they are freed with JobSystem::ResetJobs(),
+//      the task has to be finished by then
+// - The coroutine doesn't start before its job runs, a JobTask that never becomes a job destroys its frame
+// - No exceptions, an escaping exception terminates like in a plain job
+
+class JobSystem;
+
+class JobTask
+{
+public:
+	struct promise_type
+	{
+		JobTask get_return_object()
+		{
+			return JobTask(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+
+		// started by its job, finished frames free themselves (the memory stays in the arena)
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+
+		template <typename... Args>
+		static void* operator new(size_t size, Args&... args)
+		{
+			static_assert((IsJobSystem<Args>::value || ...), "JobTask: the coroutine needs a JobSystem& or JobSystem* parameter to allocate its frame");
+			return AllocateFrame(*FindJobSystem(args...), size);
+		}
+
+		// the arena frees all frames at once
+		static void operator delete(void*) noexcept {}
+	};
+
+	JobTask(JobTask&& other) noexcept;
+	JobTask& operator=(JobTask&& other) noexcept;
+	~JobTask();
+
+	JobTask(const JobTask&) = delete;
+	JobTask& operator=(const JobTask&) = delete;
+
+	// hands the coroutine over to its job, the task is empty afterwards
+	std::coroutine_handle<> Release();
+
+private:
+	explicit JobTask(std::coroutine_handle<promise_type> coroutine);
+
+	template <typename T>
+	struct IsJobSystem : std::bool_constant<std::is_same_v<T, JobSystem> || std::is_same_v<std::remove_cv_t<T>, JobSystem*>>
+	{
+	};
+
+	static JobSystem* FindJobSystem()
+	{
+		return nullptr;
+	}
+
+	template <typename First, typename... Rest>
+	static JobSystem* FindJobSystem(First& first, Rest&... rest)
+	{
+		if constexpr (std::is_same_v<First, JobSystem>)
+		{
+			return &first;
+		}
+		else if constexpr (std::is_same_v<std::remove_cv_t<First>, JobSystem*>)
+		{
+			return first;
+		}
+		else
+		{
+			return FindJobSystem(rest...);
+		}
+	}
+
+	static void* AllocateFrame(JobSystem& jobSystem, size_t size);
+
+	std::coroutine_handle<promise_type> mCoroutine;
+};
+
+// result of JobSystem::Await, co_await it from within a JobTask
+// doesn't suspend if all jobs are already finished (reset jobs count as finished) or the counter reached its target
+class JobAwaiter
+{
+public:
+	JobAwaiter(JobSystem& jobSystem, JobHandle job);
+	// the handles are only read while suspending, so they may be a temporary of the co_await expression
+	JobAwaiter(JobSystem& jobSystem, const JobHandle* jobs, size_t numJobs);
+	JobAwaiter(JobSystem& jobSystem, JobCounter& counter, int32_t target);
+
+	bool await_ready() const;
+	bool await_suspend(std::coroutine_handle<> coroutine);
+	void await_resume() const;
+
+private:
+	JobSystem& mJobSystem;
+	JobHandle mJob;
+	const JobHandle* mJobs;
+	size_t mNumJobs;
+	JobCounter* mCounter;
+	int32_t mTarget;
+};
@@ -2,6 +2,15 @@
 #include "job_system.h"
 #include "../optick/src/optick.h"
 
+#include <algorithm>
+
+#ifdef __linux__
+	#include <pthread.h>
+	#include <sched.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+#endif
+
 #ifdef _WIN32
 	#include <Windows.h>
 	#include <processthreadsapi.h>
@@ -16,6 +25,9 @@
 // use static counter to signal Optick which worker this is
 static std::atomic_uint32_t sWorkerCounter{ 0 };
 
+// worker running on the current thread, stays nullptr on non worker threads
+static thread_local JobWorker* sCurrentWorker{ nullptr };
+
 JobWorker::JobWorker() : mId(sWorkerCounter++)
 {
 	HTL_LOGT(mId, "Creating worker");
@@ -25,46 +37,105 @@ JobWorker::JobWorker() : mId(sWorkerCounter++)
 		OPTICK_THREAD(workerName.c_str());
 
 		// setting owning threadId for colored debug output
-		mJobDeque.ThreadId = mId;
+		for (uint32_t priority = 0; priority < NUM_JOB_PRIORITIES; priority++)
+		{
+			mJobDeques[priority].ThreadId = mId;
+		}
+		sCurrentWorker = this;
 
 		Run();
 	});
-	SetThreadAffinity();
 }
 
-void JobWorker::SetThreadAffinity()
+bool JobWorker::SetThreadAffinity(uint32_t cpu)
 {
-#ifdef _WIN32
-	DWORD_PTR dw = SetThreadAffinityMask(mThread.native_handle(), DWORD_PTR(1) << mId);
+#if defined(_WIN32)
+	if (cpu >= sizeof(DWORD_PTR) * 8)
+	{
+		HTL_LOGW("Can't pin worker " << mId << " to cpu " << cpu << ", only the first processor group is supported");
+		return false;
+	}
+	DWORD_PTR dw = SetThreadAffinityMask(mThread.native_handle(), DWORD_PTR(1) << cpu);
 	if (dw == 0)
 	{
 		DWORD dwErr = GetLastError();
 		HTL_LOGE("SetThreadAffinityMask failed, GLE=" << dwErr << ")");
+		return false;
+	}
+#elif defined(__linux__)
+	if (cpu >= CPU_SETSIZE)
+	{
+		HTL_LOGW("Can't pin worker " << mId << " to cpu " << cpu << ", cpu id too big for cpu_set_t");
+		return false;
+	}
+	cpu_set_t cpuSet;
+	CPU_ZERO(&cpuSet);
+	CPU_SET(cpu, &cpuSet);
+	int error = pthread_setaffinity_np(mThread.native_handle(), sizeof(cpuSet), &cpuSet);
+	if (error != 0)
+	{
+		HTL_LOGE("pthread_setaffinity_np failed for worker " << mId << " on cpu " << cpu << ", error " << error);
+		return false;
 	}
 #else
-	HTL_LOGW("SetThreadAffinityMask currently only supported on _WIN32");
+	HTL_LOGW("Thread affinity is not supported on this platform");
+	return false;
 #endif
+	mCpu = static_cast<int32_t>(cpu);
+	HTL_LOGT(mId, "Pinned to cpu " << cpu);
+	return true;
 }
 
-void JobWorker::AddJob(Job* job)
+int32_t JobWorker::GetCpu() const
 {
-	// (*) fix LIFO / FIFO for private / public end
-#ifdef HTL_USING_LOCKLESS
-	mJobDeque.PushBack(job);
-#else
-	mJobDeque.PushFront(job);
-#endif
-	HTL_LOGT(mId, "Pushed " << job->GetName() << " as job #" << mJobDeque.Size() << " to Thread #" << mId);
+	return mCpu;
+}
 
-	{
-		std::unique_lock<std::mutex> lock(mAwakeMutex);
-		mAwakeCondition.notify_one();
-	}
+void JobWorker::SetNumaNode(uint32_t numaNode)
+{
+	mNumaNode = numaNode;
+}
+
+uint32_t JobWorker::GetNumaNode() const
+{
+	return mNumaNode;
 }
 
-bool JobWorker::AllJobsFinished() const
+void JobWorker::SetJobSystem(JobSystem* jobSystem)
 {
-	return !(mJobDeque.Size() > 0 || mJobRunning);
+	mJobSystem.store(jobSystem, std::memory_order_release);
+}
+
+JobSystem* JobWorker::GetJobSystem() const
+{
+	return mJobSystem.load(std::memory_order_acquire);
+}
+
+void JobWorker::SetVictims(StealTier tier, const std::vector<uint32_t>& victims)
+{
+	mVictims[static_cast<uint32_t>(tier)] = victims;
+}
+
+JobWorker* JobWorker::GetCurrentWorker()
+{
+	return sCurrentWorker;
+}
+
+void JobWorker::AddJob(Job* job)
+{
+	uint32_t priority = static_cast<uint32_t>(job->GetPriority());
+	mJobDeques[priority].Push(job);
+	HTL_LOGT(mId, "Pushed " << job->GetName() << " as job #" << mJobDeques[priority].Size() << " with priority " << priority << " to Thread #" << mId);
+}
+
+size_t JobWorker::GetNumJobs() const
+{
+	size_t numJobs = 0;
+	for (uint32_t priority = 0; priority < NUM_JOB_PRIORITIES; priority++)
+	{
+		numJobs += mJobDeques[priority].Size();
+	}
+	return numJobs;
 }
 
 void JobWorker::Shutdown()
@@ -75,59 +146,207 @@ void JobWorker::Shutdown()
 
 	// need to clear all remaining tasks
 	mJobRunning = false;
-	mJobDeque.Clear();
-
-	// wait for thread end by waking up and waiting for finish
+	for (uint32_t priority = 0; priority < NUM_JOB_PRIORITIES; priority++)
 	{
-		std::unique_lock<std::mutex> lock(mAwakeMutex);
-		mAwakeCondition.notify_one();
+		mJobDeques[priority].Clear();
 	}
+
+	// wait for thread end by waking up and waiting for finish
+	mAwake.NotifyAll();
 	mThread.join();
 	HTL_LOGT(mId, "Worker thread successfully shutdown");
 }
 
 void JobWorker::Run()
 {
-	HTL_LOGT(mId, "Starting worker");
-	while (mRunning)
+	// victims, numa node and the job system itself are set up after the thread started
+	while (GetJobSystem() == nullptr && mRunning)
 	{
-#ifdef HTL_WAIT_FOR_AVAILABLE_JOBS
-		if (mJobDeque.HasExecutableJobs() == false)
-		{
-			if (JobSystem != nullptr)
-			{
-				JobSystem->WakeThreads();
-			}
-			WaitForJob();
-		}
+		std::this_thread::yield();
+	}
+
+	HTL_LOGT(mId, "Starting worker");
+#ifdef HTL_FIBERS
+	RunFibers();
 #else
-		if (mJobDeque.Size() == 0)
-		{
-			WaitForJob();
-		}
+	RunJobs();
 #endif
+}
 
+void JobWorker::RunJobs()
+{
+	while (mRunning && !HasResumableFibers())
+	{
 		// fake job running, so worker doesn't get shut down between getting job and setting JobRunning
 		mJobRunning = true;
 		if (Job* job = GetJob())
 		{
-			HTL_LOGT(mId, "Starting work on job " << job->GetName());
+			mIdlePolicy.OnWork(GetJobSystem()->GetIdleSettings());
 
-			job->Execute();
-			if (!job->IsFinished())
+			// a finished job hands over its first ready dependant, which runs right here with warm caches
+			while (job != nullptr)
 			{
-				HTL_LOGTE(mId, "Job " << job->GetName() << " not finished after execution :-o open unfinishedJobs: " << job->GetUnfinishedJobs());
+				HTL_LOGT(mId, "Starting work on job " << job->GetName());
+				if (!job->CanExecute())
+				{
+					HTL_LOGTE(mId, "Job " << job->GetName() << " scheduled with open dependencies: " << job->GetUnfinishedJobs());
+				}
+
+				// the job may already be freed by a waiting thread after executing
+				job = job->Execute(*GetJobSystem());
 			}
 			mJobRunning = false;
 		}
 		else
 		{
-			// yield if no executable jobs are available
-			// and hope next worker has available jobs
-			HTL_LOGT(mId, "Yield");
 			mJobRunning = false;
-			std::this_thread::yield();
+			Idle();
+		}
+	}
+}
+
+#ifdef HTL_FIBERS
+void JobWorker::RunFibers()
+{
+	Fiber scheduler;
+	mSchedulerFiber = &scheduler;
+#if USE_OPTICK
+	#if defined(_WIN32)
+	mOptickThreadId = GetCurrentThreadId();
+	#elif defined(__linux__)
+	mOptickThreadId = static_cast<uint64_t>(syscall(SYS_gettid));
+	#endif
+#endif
+
+	while (mRunning)
+	{
+		// a parked job is already half done and someone may wait for it, so it goes first
+		Fiber* fiber = PopResumableFiber();
+		if (fiber == nullptr)
+		{
+			fiber = GetJobSystem()->GetFiberPool().Acquire();
+		}
+		if (fiber == nullptr)
+		{
+			// all fibers are parked, run jobs right here until one of them can continue
+			// waiting can't park without a fiber, so WaitFor helps like without fibers meanwhile
+			RunJobs();
+			continue;
 		}
+
+		fiber->UserData = this;
+		SwitchToFiber(fiber);
+		if (!mFiberParked)
+		{
+			GetJobSystem()->GetFiberPool().Release(fiber);
+		}
+		mFiberParked = false;
+	}
+	mSchedulerFiber = nullptr;
+}
+
+void JobWorker::RunFiber(Fiber* fiber)
+{
+	// pooled fibers are reused by any worker, so only the fiber knows whose loop to run after a switch
+	while (true)
+	{
+		JobWorker* worker = static_cast<JobWorker*>(fiber->UserData);
+		worker->RunJobs();
+		// back to the scheduler, which returns us to the pool
+		Fiber::Switch(*fiber, *worker->mSchedulerFiber);
+	}
+}
+
+void JobWorker::SwitchToFiber(Fiber* fiber)
+{
+	// a fresh fiber doesn't execute a job yet, a parked one restores its own
+	Job::SetCurrentJob(nullptr, JobPriority::Normal);
+	mCurrentFiber = fiber;
+#if USE_OPTICK
+	// the thread records into the fiber's storage meanwhile, so a parked job's events continue where they stopped
+	Optick::EventStorage** storageSlot = Optick::GetEventStorageSlotForCurrentThread();
+	Optick::EventStorage* threadStorage = *storageSlot;
+	*storageSlot = fiber->OptickStorage;
+	Optick::FiberSyncData::AttachToThread(fiber->OptickStorage, mOptickThreadId);
+#endif
+
+	Fiber::Switch(*mSchedulerFiber, *fiber);
+
+#if USE_OPTICK
+	Optick::FiberSyncData::DetachFromThread(fiber->OptickStorage);
+	*storageSlot = threadStorage;
+#endif
+	mCurrentFiber = nullptr;
+}
+
+Fiber* JobWorker::GetCurrentFiber() const
+{
+	return mCurrentFiber;
+}
+
+void JobWorker::ParkCurrentFiber()
+{
+	Fiber* fiber = mCurrentFiber;
+	Job* job = Job::GetCurrentJob();
+	JobPriority priority = Job::GetCurrentPriority();
+	HTL_LOGT(mId, "Parking fiber while job " << (job != nullptr ? job->GetName() : "none") << " waits");
+
+	mFiberParked = true;
+	Fiber::Switch(*fiber, *mSchedulerFiber);
+
+	// resumed by our own scheduler, meanwhile other jobs ran on this thread
+	Job::SetCurrentJob(job, priority);
+	HTL_LOGT(mId, "Resumed fiber of job " << (job != nullptr ? job->GetName() : "none"));
+}
+
+void JobWorker::ResumeFiber(Fiber* fiber)
+{
+	Fiber* head = mResumableFibers.load(std::memory_order_relaxed);
+	do
+	{
+		fiber->Next = head;
+	} while (!mResumableFibers.compare_exchange_weak(head, fiber, std::memory_order_release, std::memory_order_relaxed));
+
+	// pairs with the fence in EventCount::PrepareWait: either we see the worker sleeping or it sees the fiber
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	WakeUpIfWaiting();
+}
+
+Fiber* JobWorker::PopResumableFiber()
+{
+	// only the owner pops, so the head can't be taken away between reading its link and the exchange
+	Fiber* head = mResumableFibers.load(std::memory_order_acquire);
+	while (head != nullptr && !mResumableFibers.compare_exchange_weak(head, head->Next, std::memory_order_acquire, std::memory_order_acquire));
+	return head;
+}
+#endif
+
+bool JobWorker::HasResumableFibers() const
+{
+#ifdef HTL_FIBERS
+	return mResumableFibers.load(std::memory_order_relaxed) != nullptr;
+#else
+	return false;
+#endif
+}
+
+void JobWorker::Idle()
+{
+	switch (mIdlePolicy.Next(GetJobSystem()->GetIdleSettings()))
+	{
+	case IdlePolicy::Action::Spin:
+		HTL_CPU_PAUSE();
+		break;
+	case IdlePolicy::Action::Yield:
+		// give the slot to another thread, maybe it produces something for us
+		HTL_LOGT(mId, "Yield");
+		std::this_thread::yield();
+		break;
+	case IdlePolicy::Action::Park:
+		// nothing to wake up here: a worker only parks with an empty deque,
+		// so every job in a deque has an awake owner and every new one wakes a sleeper
+		WaitForJob();
+		break;
 	}
 }
 
@@ -135,6 +354,12 @@ Job* JobWorker::GetJob()
 {
 	if (Job* job = GetJobFromOwnQueue())
 	{
+		mFailedLocalSteals = 0;
+		return job;
+	}
+	else if (Job* job = GetJobFromInjectionQueue())
+	{
+		mFailedLocalSteals = 0;
 		return job;
 	}
 	else if (Job* job = StealJobFromOtherQueue())
@@ -148,82 +373,265 @@ Job* JobWorker::GetJob()
 
 Job* JobWorker::GetJobFromOwnQueue()
 {
-	// execute our own jobs first
-	// private end allow to get unexecutable jobs if has more than one job to be able to reorder
-	bool allowOpenDependencies = mJobDeque.Size() > 1;
-	if (Job* job = mJobDeque.PopFront(allowOpenDependencies))
+	// give the lowest priority a turn from time to time, otherwise a steady stream of urgent jobs starves it
+	if (mSkipsOfLowerPriorities >= MAX_SKIPS_OF_LOWER_PRIORITIES)
+	{
+		mSkipsOfLowerPriorities = 0;
+		for (uint32_t priority = NUM_JOB_PRIORITIES; priority-- > 0;)
+		{
+			if (Job* job = mJobDeques[priority].Pop())
+			{
+				HTL_LOGT(mId, "Job found at private end after skipping its priority too often: " << job->GetName());
+				return job;
+			}
+		}
+		return nullptr;
+	}
+
+	// execute our own jobs first, most urgent priority first
+	// private end is LIFO so we get the hottest job
+	for (uint32_t priority = 0; priority < NUM_JOB_PRIORITIES; priority++)
 	{
-		if (job->CanExecute())
+		if (Job* job = mJobDeques[priority].Pop())
 		{
-			HTL_LOGT(mId, "Job found in current front: " << job->GetName());
+			HTL_LOGT(mId, "Job found at private end: " << job->GetName());
+			mSkipsOfLowerPriorities = HasJobsBelow(priority) ? mSkipsOfLowerPriorities + 1 : 0;
 			return job;
 		}
+	}
+	HTL_LOGT(mId, "No own job found -> check other queues");
+	return nullptr;
+}
 
-		// if current front job can't be executed because of dependencies
-		// move front to back so we can maybe execute the following job
-		// and another worker may steal the dependant one after resolving dependencies
-		mJobDeque.PushBack(job);
-		if (mJobDeque.Size() > 1)
+bool JobWorker::HasJobsBelow(uint32_t priority) const
+{
+	for (uint32_t lower = priority + 1; lower < NUM_JOB_PRIORITIES; lower++)
+	{
+		if (mJobDeques[lower].Size() > 0)
 		{
-			HTL_LOGT(mId, "First front job was not executable -> try getting next one from back...");
-			if (Job* otherJob = mJobDeque.PopFront())
-			{
-				HTL_LOGT(mId, "Second job found in current back: " << otherJob->GetName());
-				return otherJob;
-			}
+			return true;
 		}
 	}
-	HTL_LOGT(mId, "No executable own job found -> check other queues");
+	return false;
+}
+
+Job* JobWorker::GetJobFromInjectionQueue()
+{
+	if (!GetJobSystem()->HasInjectedJobs()) return nullptr;
+
+	// take a fair share of the submitted jobs, so other workers get some as well
+	// the rest is still stealable from our deque
+	size_t batchSize = GetJobSystem()->GetNumInjectedJobs() / GetJobSystem()->GetNumWorkers();
+	batchSize = std::min(std::max(batchSize, size_t(1)), MAX_INJECTION_BATCH);
+
+	Job* jobs[MAX_INJECTION_BATCH];
+	size_t count = GetJobSystem()->TakeInjectedJobs(jobs, batchSize);
+	// newest first, so we pop the oldest injected job first and thieves get the newer ones
+	for (size_t i = count; i-- > 0;)
+	{
+		AddJob(jobs[i]);
+	}
+
+	if (count > 0)
+	{
+		HTL_LOGT(mId, "Took " << count << " jobs from injection queue");
+		return GetJobFromOwnQueue();
+	}
 	return nullptr;
 }
 
 Job* JobWorker::StealJobFromOtherQueue()
 {
-	if (JobSystem == nullptr || JobSystem->GetNumWorkers() < 2) return nullptr;
+	if (GetJobSystem()->GetNumWorkers() < 2) return nullptr;
 
-	// try stealing from another random worker queue (excluding ourselves)
-	// random generated index is the same as internal thread id
-	unsigned int randomNumber = JobSystem->GetRandomWorkerThreadId(mId);
+	// every round counts, also one where all probed victims look empty and no deque is touched,
+	// so the strategies are compared by the same measure
+	mStealAttempts++;
+	StealSettings settings = GetJobSystem()->GetStealSettings();
+	if (settings.LastVictimFirst && mLastVictim >= 0)
+	{
+		if (Job* job = StealJobFrom(static_cast<uint32_t>(mLastVictim), settings.StealHalf))
+		{
+			return job;
+		}
+		mLastVictim = -1;
+	}
 
-	HTL_LOGT(mId, "Try stealing job from worker queue #" << randomNumber);
-	JobWorker* workerToStealFrom = &JobSystem->GetWorkers()[randomNumber];
-	if (Job* job = workerToStealFrom->mJobDeque.PopBack())
+	// one victim per tier, closest first: a stolen job from a neighbour brings its data
+	// through a shared cache, from another node it has to cross the interconnect
+	const std::vector<uint32_t>& remoteVictims = mVictims[static_cast<uint32_t>(StealTier::Remote)];
+	bool hasLocalVictims = remoteVictims.size() + 1 < GetJobSystem()->GetNumWorkers();
+	for (uint32_t tier = 0; tier < NUM_STEAL_TIERS; tier++)
 	{
-		// successfully stolen a job from another queues public end
-		HTL_LOGT(mId, "Job " << job->GetName() << " successfully stolen");
-		return job;
+		const std::vector<uint32_t>& victims = mVictims[tier];
+		if (victims.empty())
+		{
+			continue;
+		}
+		if (&victims == &remoteVictims && hasLocalVictims && mFailedLocalSteals < REMOTE_STEAL_DELAY)
+		{
+			// give the neighbours a few more chances to produce work first
+			mFailedLocalSteals++;
+			return nullptr;
+		}
+
+		uint32_t victim = ChooseVictim(victims, settings.NumProbes);
+		if (victim == NO_VICTIM)
+		{
+			continue;
+		}
+		HTL_LOGT(mId, "Try stealing job from worker queue #" << victim << " (tier " << tier << ")");
+		if (Job* job = StealJobFrom(victim, settings.StealHalf))
+		{
+			return job;
+		}
+	}
+	return nullptr;
+}
+
+Job* JobWorker::StealJobFrom(uint32_t victim, bool stealHalf)
+{
+	Job* jobs[MAX_STEAL_BATCH];
+	size_t count = GetJobSystem()->GetWorkers()[victim].StealJobs(jobs, stealHalf ? MAX_STEAL_BATCH : 1);
+	if (count == 0)
+	{
+		return nullptr;
+	}
+
+	// successfully stolen from another queues public end, we run the oldest job ourselves
+	// and keep the rest stealable in our own deque
+	HTL_LOGT(mId, "Job " << jobs[0]->GetName() << " successfully stolen, " << count - 1 << " more taken along");
+	for (size_t i = 1; i < count; ++i)
+	{
+		AddJob(jobs[i]);
+	}
+	if (count > 1)
+	{
+		// a woken worker steals half of our share in turn, so a burst spreads in a logarithmic number of rounds
+		GetJobSystem()->WakeIdleWorker();
+	}
+
+	mSuccessfulSteals++;
+	mStolenJobs += count;
+	mFailedLocalSteals = 0;
+	mLastVictim = static_cast<int32_t>(victim);
+	return jobs[0];
+}
+
+uint32_t JobWorker::ChooseVictim(const std::vector<uint32_t>& victims, uint32_t numProbes)
+{
+	uint32_t victim = victims[mRandom.Rand(0, static_cast<uint32_t>(victims.size()))];
+	if (numProbes <= 1)
+	{
+		return victim;
+	}
+
+	// the sizes are only snapshots, but reading them is much cheaper than a failing CAS
+	JobWorker* workers = GetJobSystem()->GetWorkers();
+	size_t mostJobs = workers[victim].GetNumJobs();
+	for (uint32_t probe = 1; probe < numProbes; probe++)
+	{
+		uint32_t candidate = victims[mRandom.Rand(0, static_cast<uint32_t>(victims.size()))];
+		size_t numJobs = workers[candidate].GetNumJobs();
+		if (numJobs > mostJobs)
+		{
+			victim = candidate;
+			mostJobs = numJobs;
+		}
+	}
+	return mostJobs > 0 ? victim : NO_VICTIM;
+}
+
+uint64_t JobWorker::GetStealAttempts() const
+{
+	return mStealAttempts;
+}
+
+uint64_t JobWorker::GetSuccessfulSteals() const
+{
+	return mSuccessfulSteals;
+}
+
+uint64_t JobWorker::GetStolenJobs() const
+{
+	return mStolenJobs;
+}
+
+Job* JobWorker::StealJob()
+{
+	// an empty deque costs a thief two loads, no CAS
+	for (uint32_t priority = 0; priority < NUM_JOB_PRIORITIES; priority++)
+	{
+		if (Job* job = mJobDeques[priority].Steal())
+		{
+			return job;
+		}
 	}
 	return nullptr;
 }
 
+size_t JobWorker::StealJobs(Job** jobs, size_t maxCount)
+{
+	if (maxCount == 1)
+	{
+		jobs[0] = StealJob();
+		return jobs[0] != nullptr ? 1 : 0;
+	}
+
+	// a batch only comes from one priority, so all stolen jobs go to the same deque of the thief
+	for (uint32_t priority = 0; priority < NUM_JOB_PRIORITIES; priority++)
+	{
+		if (size_t count = mJobDeques[priority].StealHalf(jobs, maxCount))
+		{
+			return count;
+		}
+	}
+	return 0;
+}
+
+bool JobWorker::HasWork() const
+{
+	if (GetJobSystem()->HasInjectedJobs())
+	{
+		return true;
+	}
+	return GetNumJobs() > 0 || HasResumableFibers();
+}
+
 inline void JobWorker::WaitForJob()
 {
-	HTL_LOGT(mId, "Waiting for jobs");
-	// awake on JobQueue not empty (work to be done) or Running is disabled (shutdown requested)
-	std::unique_lock<std::mutex> lock(mAwakeMutex);
-	mAwakeCondition.wait(lock, [this]
+	// awake on work to be done or Running is disabled (shutdown requested)
+	// checking after announcing to wait, so a job pushed in between can't be missed
+	// the fence in PrepareWait also orders joining the sleepers before the check
+	GetJobSystem()->AddSleepingWorker(*this);
+	EventCount::Key key = mAwake.PrepareWait();
+	// a waker may have claimed our bit before PrepareWait, found no waiter and moved on, so join again
+	// a waker claiming it from here on sees us waiting and notifies us, then the bit is only stale until we remove it below
+	GetJobSystem()->AddSleepingWorker(*this);
+	bool hasWork = HasWork();
+	bool running = mRunning;
+	HTL_LOGT(mId, "Checking Wake up: HasWork=" << hasWork << ", Running=" << running << "; Waking up: " << (hasWork | !running));
+	if (hasWork || !running)
 	{
-#ifdef HTL_WAIT_FOR_AVAILABLE_JOBS
-		size_t size = mJobDeque.HasExecutableJobs() ? 1 : 0;
-#else
-		size_t size = mJobDeque.Size();
-#endif
-		bool running = mRunning;
-		HTL_LOGT(mId, "Checking Wake up: Size=" << size << ", Running=" << running << "; Waking up: " << ((size > 0) | !running));
+		mAwake.CancelWait();
+		GetJobSystem()->RemoveSleepingWorker(*this);
+		return;
+	}
 
-		return ((size > 0) | !running);
-	});
+	HTL_LOGT(mId, "Waiting for jobs");
+	mAwake.Wait(key);
+	// already gone if the one waking us claimed our bit, still set if we woke for another reason
+	GetJobSystem()->RemoveSleepingWorker(*this);
 	HTL_LOGT(mId, "Awake success!");
 }
 
-bool JobWorker::WakeUp()
+// only notify if the worker actually sleeps
+bool JobWorker::WakeUpIfWaiting()
 {
-	if (mJobDeque.HasExecutableJobs())
+	if (mAwake.HasWaiters())
 	{
-		HTL_LOGT(mId, "Wake up call from job system");
-		std::unique_lock<std::mutex> lock(mAwakeMutex);
-		mAwakeCondition.notify_one();
-		return true;
+		HTL_LOGT(mId, "Wake up call for injected jobs");
+		return mAwake.NotifyOne();
 	}
 	return false;
 }
@@ -231,5 +639,8 @@ bool JobWorker::WakeUp()
 void JobWorker::Print() const
 {
 	HTL_LOG("worker thread " << mId << " running: " << mRunning << ", job running: " << mJobRunning);
-	mJobDeque.Print();
+	for (uint32_t priority = 0; priority < NUM_JOB_PRIORITIES; priority++)
+	{
+		mJobDeques[priority].Print();
+	}
 }
\ No newline at end of file
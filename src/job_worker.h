@@ -1,49 +1,201 @@
 #pragma once
 
 #include "defines.h"
+#include "event_count.h"
+#include "idle_policy.h"
+#include "random.h"
+#ifdef HTL_FIBERS
+	#include "fiber.h"
+#endif
 #ifdef HTL_USING_LOCKLESS
 	#include "lockless_deque.h"
 #else
 	#include "locking_deque.h"
 #endif
 
+#include <atomic>
+#include <vector>
+
 class JobSystem;
 
+// how a worker picks its victim inside a steal tier
+struct StealSettings
+{
+	// try the worker we stole from last time first, it probably still has more of the same work
+	bool LastVictimFirst{ false };
+	// look at the deque size of this many random victims and steal from the fullest, 1 just picks one
+	// victims that all look empty are skipped without a CAS
+	uint32_t NumProbes{ 1 };
+	// take up to half of the victim's jobs instead of a single one, the rest goes to the own deque
+	bool StealHalf{ true };
+};
+
 class JobWorker
 {
+public:
+	// victims grouped by distance, stealing tries them in this order
+	enum class StealTier : uint32_t
+	{
+		SameCache,
+		SameNode,
+		Remote
+	};
+	static const uint32_t NUM_STEAL_TIERS = 3;
+
 private:
 	uint32_t mId;
 	std::thread mThread;
-	std::mutex mAwakeMutex;
-	std::condition_variable mAwakeCondition;
+	// cpu the worker is pinned to, -1 if not pinned
+	int32_t mCpu{ -1 };
+	// index into CpuTopology::GetNumaNodes(), selects the job arena
+	uint32_t mNumaNode{ 0 };
+	// the thread runs from construction on, so the job system and everything it set up before is published with this
+	std::atomic<JobSystem*> mJobSystem{ nullptr };
+
+	// indices of the other workers per steal tier, set up by the JobSystem before it starts using the worker
+	std::vector<uint32_t> mVictims[NUM_STEAL_TIERS];
+	// local steal rounds that failed since we last found work, remote nodes are only tried after a few
+	uint32_t mFailedLocalSteals{ 0 };
+	// index of the worker we last stole from successfully, -1 if the last try there failed
+	int32_t mLastVictim{ -1 };
+	// only the owner picks victims with it, so no synchronization needed
+	Random mRandom;
+
+	// only written by the owner, read them once the worker stopped
+	uint64_t mStealAttempts{ 0 };
+	uint64_t mSuccessfulSteals{ 0 };
+	uint64_t mStolenJobs{ 0 };
 
+	// the worker parks on this while there is no work, producers only notify if it actually sleeps
+	EventCount mAwake;
+
+	// spin, yield or park when no job was found
+	IdlePolicy mIdlePolicy;
+
+	// one deque per JobPriority, the most urgent first
 #ifdef HTL_USING_LOCKLESS
-	LocklessDeque mJobDeque;
+	LocklessDeque mJobDeques[NUM_JOB_PRIORITIES];
 #else
-	LockingDeque mJobDeque;
+	LockingDeque mJobDeques[NUM_JOB_PRIORITIES];
 #endif
+	// jobs taken from the own deques while a lower priority had work as well
+	uint32_t mSkipsOfLowerPriorities{ 0 };
 
 	std::atomic_bool mJobRunning{ false };
 	std::atomic_bool mRunning{ true };
 
+#ifdef HTL_FIBERS
+	// the worker thread's own context, it picks the fiber running the job loop and gets control back
+	// whenever that one parks or stops
+	Fiber* mSchedulerFiber{ nullptr };
+	// fiber running on this worker right now, nullptr while the scheduler runs jobs itself
+	Fiber* mCurrentFiber{ nullptr };
+	// set by a fiber right before it switches back, so the scheduler keeps it instead of returning it to the pool
+	bool mFiberParked{ false };
+	// parked fibers whose wait is over, newest first, pushed by any thread and only popped by the owner
+	std::atomic<Fiber*> mResumableFibers{ nullptr };
+#if USE_OPTICK
+	// fibers are shown on the thread they run on
+	uint64_t mOptickThreadId{ 0 };
+#endif
+#endif
+
+	// upper bound of jobs taken from the injection queue at once
+	static const size_t MAX_INJECTION_BATCH = 32;
+
+	// failed steal rounds in the own node before a worker steals across the interconnect
+	static const uint32_t REMOTE_STEAL_DELAY = 8;
+
+	// after this many skips the lowest own priority with work gets a turn, so background jobs don't starve
+	// as long as more urgent jobs keep coming in
+	static const uint32_t MAX_SKIPS_OF_LOWER_PRIORITIES = 16;
+
+	// upper bound of jobs taken from a victim at once
+	static const size_t MAX_STEAL_BATCH = 32;
+
 	void Run();
-	void SetThreadAffinity();
+	// job loop, returns on shutdown and, on a fiber, as soon as a parked fiber can continue
+	void RunJobs();
+#ifdef HTL_FIBERS
+	// scheduler loop on the worker thread, runs resumable fibers first and fresh ones from the pool otherwise
+	void RunFibers();
+	void SwitchToFiber(Fiber* fiber);
+	Fiber* PopResumableFiber();
+#endif
+	bool HasResumableFibers() const;
 
+	bool HasWork() const;
+	void Idle();
 	void WaitForJob();
-	Job* GetJob();
 	Job* GetJobFromOwnQueue();
+	bool HasJobsBelow(uint32_t priority) const;
+	Job* GetJobFromInjectionQueue();
 	Job* StealJobFromOtherQueue();
+	Job* StealJobFrom(uint32_t victim, bool stealHalf);
+	// returns NO_VICTIM if all probed victims look empty
+	uint32_t ChooseVictim(const std::vector<uint32_t>& victims, uint32_t numProbes);
+	static const uint32_t NO_VICTIM = UINT32_MAX;
 
 public:
 	JobWorker();
 
+	// returns the worker running on the calling thread, nullptr if called from a non worker thread
+	static JobWorker* GetCurrentWorker();
+
+	// pushes to the deque of the job's priority
+	// only allowed from the owning thread, use JobSystem::AddJob otherwise
+	// doesn't wake anybody, JobSystem::Schedule decides if another worker is needed
 	void AddJob(Job* job);
-	bool AllJobsFinished() const;
+
+	// own queue first, then injected jobs, then stealing, only allowed from the owning thread
+	// the own queue and victims are drained by priority
+	Job* GetJob();
+
+	// take the oldest job of the most urgent priority from the public end, allowed from any thread
+	Job* StealJob();
+	// take up to half of the jobs of the most urgent priority from the public end, oldest first, allowed from any thread
+	size_t StealJobs(Job** jobs, size_t maxCount);
+
+	// only a snapshot of the own deques, may already be outdated when returning
+	size_t GetNumJobs() const;
 
 	void Shutdown();
-	bool WakeUp();
 
-	JobSystem* JobSystem{ nullptr };
+	// pin the worker thread to one logical cpu, see CpuTopology for the placement
+	bool SetThreadAffinity(uint32_t cpu);
+	int32_t GetCpu() const;
+
+	void SetNumaNode(uint32_t numaNode);
+	uint32_t GetNumaNode() const;
+	void SetVictims(StealTier tier, const std::vector<uint32_t>& victims);
+
+	// number of steal rounds (one search for a victim, whether one looked worth a try or not),
+	// how many of them got a job and how many jobs they got in total, only reliable after shutdown
+	uint64_t GetStealAttempts() const;
+	uint64_t GetSuccessfulSteals() const;
+	uint64_t GetStolenJobs() const;
+
+	// returns false without a syscall if the worker is awake
+	bool WakeUpIfWaiting();
+
+#ifdef HTL_FIBERS
+	// fiber running the calling job, nullptr if the worker runs jobs without one (e.g. all fibers are parked)
+	// only from the owning thread
+	Fiber* GetCurrentFiber() const;
+	// switches back to the scheduler and returns once ResumeFiber was called for the fiber, meanwhile the worker
+	// goes on with other jobs on another fiber; only from the owning thread and on a fiber
+	// ResumeFiber may already come before the fiber left, it only continues once it is parked
+	void ParkCurrentFiber();
+	// lets a parked fiber of this worker continue as soon as the worker is between two jobs, may be called from any thread
+	void ResumeFiber(Fiber* fiber);
+
+	// entry of the pooled fibers, runs the job loop of the worker given in the fiber's UserData
+	static void RunFiber(Fiber* fiber);
+#endif
+
+	// the worker thread waits for this before it touches anything else set up by the job system
+	void SetJobSystem(JobSystem* jobSystem);
+	JobSystem* GetJobSystem() const;
 
 	void Print() const;
 };
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include "job.h"
 
+#include <algorithm>
 #include <mutex>
 #include <deque>
 
@@ -25,19 +26,6 @@ public:
         return mSize;
     }
 
-    size_t HasExecutableJobs() const
-    {
-        lock_guard lock(mJobDequeMutex);
-        for (size_t i = 0; i < mSize; ++i)
-        {
-            if (mJobDeque[i]->CanExecute())
-            {
-                return true;
-            }
-        }
-        return false;
-    }
-
     void Clear()
     {
         lock_guard lock(mJobDequeMutex);
@@ -48,54 +36,52 @@ public:
         }
     }
 
-    // default push filled from worker
-    void PushFront(Job* job)
-    {
-        lock_guard lock(mJobDequeMutex);
-        mJobDeque.push_front(job);
-        mSize++;
-    }
-
-    // needed to re-append front job if dependencies are not met yet
-    void PushBack(Job* job)
+    // push to private end
+    void Push(Job* job)
     {
         lock_guard lock(mJobDequeMutex);
         mJobDeque.push_back(job);
         mSize++;
     }
 
-    // pull from private FIFO end, allows to return not executable job for reordering
-    Job* PopFront (bool allowOpenDependencies = false)
+    // pull from private LIFO end
+    Job* Pop()
     {
         lock_guard lock(mJobDequeMutex);
         if (mSize == 0) return nullptr;
 
-        if (allowOpenDependencies || mJobDeque.front()->CanExecute())
-        {
-            // combining front and pop in our implementation
-            Job* job = mJobDeque.front();
-            mJobDeque.pop_front();
-            mSize--;
-            return job;
-        }
-        return nullptr;
+        // combining back and pop in our implementation
+        Job* job = mJobDeque.back();
+        mJobDeque.pop_back();
+        mSize--;
+        return job;
     }
 
     // pull from public FIFO end (stealing)
-    Job* PopBack()
+    Job* Steal()
     {
         lock_guard lock(mJobDequeMutex);
         if (mSize == 0) return nullptr;
 
-        if (mJobDeque.back()->CanExecute())
+        // combining front and pop in our implementation
+        Job* job = mJobDeque.front();
+        mJobDeque.pop_front();
+        mSize--;
+        return job;
+    }
+
+    // pull up to half of the jobs (rounded up) from the public FIFO end, at most maxCount, oldest first
+    size_t StealHalf(Job** jobs, size_t maxCount)
+    {
+        lock_guard lock(mJobDequeMutex);
+        size_t count = std::min((mSize + 1) / 2, maxCount);
+        for (size_t i = 0; i < count; ++i)
         {
-            // combining back and pop in our implementation
-            Job* job = mJobDeque.back();
-            mJobDeque.pop_back();
-            mSize--;
-            return job;
+            jobs[i] = mJobDeque.front();
+            mJobDeque.pop_front();
         }
-        return nullptr;
+        mSize -= count;
+        return count;
     }
 
     // Debug functionality for printing additional information
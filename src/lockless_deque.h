@@ -2,16 +2,22 @@
 
 // general information
 // ===================
-// - We don't delete pointers in our buffer, but just rely on boundaries
-// - Memory barriers are not used because atomic reads and writes per default use load(memory_order_seq_cst)
-// - per design pop on private end should be LIFO and on public end FIFO
-//      but I didn't pay attention at design time and changing it now would be a high risk breaking everything
-//      -> would need to start boundaries at AMOUNT-1 instead of zero and add jobs per PushFront
-//          but this way re-ordering (moving job from one end to the other because its dependencies are not fulfilled yet)
-//          would not be possible unless starting boundaries in the middle of mEntries
-//      -> alternatively and more secure would be to use a ringbuffer with generations to allow jumping over boundaries
-//          or just creating nodes on heap (which we just assume would perform worse and we already know all our jobs)
-
+// - Chase-Lev work stealing deque (Chase & Lev 2005, memory orders after Le et al. 2013)
+// - The owner pushes and pops at the bottom (private end, LIFO), so it keeps working on its most recently
+//      pushed and therefore hottest job. Thieves steal from the top (public end, FIFO) with a CAS and get
+//      the oldest jobs, which are usually the biggest chunks of remaining work
+// - Only jobs without open dependencies get pushed (see Job::Finish), so no job ever has to be checked
+//      or reordered inside the deque
+// - Indices are monotonic 64 bit counters and only get wrapped into the circular buffer by masking,
+//      so there is no need to reset boundaries when the deque drains anymore
+// - If the buffer is full, the pushing thread swaps in a buffer with twice the capacity.
+//      A thief may still read from the old buffer after the swap, so old buffers are only retired
+//      and get freed together with the deque (the retired buffers are at most as big as the current one)
+// - StealHalf moves up to half of the jobs to a thief at once, so a burst on one worker spreads over
+//      all workers in a logarithmic number of steal rounds instead of one round per job
+// - Push and Pop must only be called by the owning worker, other threads submit to the JobSystem's
+//      injection queue instead
+//
 // - atomic compare exchange
 //      bool r = x.compare_exchange_*(&expected, T desired)
 //   is the same as
@@ -24,6 +30,9 @@
 
 #include "job.h"
 
+#include <algorithm>
+#include <vector>
+
 #ifdef HTL_EXTRA_LOCKS
     #include <mutex>
 #endif
@@ -31,13 +40,59 @@
 class LocklessDeque
 {
 private:
-    Job** mEntries;
-    std::atomic_int_fast32_t mFront{ 0 }, mBack{ 0 };
+    // circular buffer with a power of two capacity, so wrapping an index is just a mask
+    struct RingBuffer
+    {
+        int64_t Capacity;
+        int64_t Mask;
+        // entries are atomic because a thief may read a slot the owner is writing at the same time
+        // (the thief then fails its CAS and drops the value)
+        std::atomic<Job*>* Entries;
+
+        explicit RingBuffer(int64_t capacity)
+            : Capacity(capacity)
+            , Mask(capacity - 1)
+            , Entries(new std::atomic<Job*>[capacity])
+        {
+        }
+
+        ~RingBuffer()
+        {
+            delete[] Entries;
+        }
+
+        Job* Get(int64_t index) const
+        {
+            return Entries[index & Mask].load(std::memory_order_relaxed);
+        }
+
+        void Put(int64_t index, Job* job)
+        {
+            Entries[index & Mask].store(job, std::memory_order_relaxed);
+        }
+
+        // copy all living entries into a buffer with twice the capacity
+        RingBuffer* Grow(int64_t top, int64_t bottom) const
+        {
+            RingBuffer* buffer = new RingBuffer(Capacity * 2);
+            for (int64_t i = top; i < bottom; ++i)
+            {
+                buffer->Put(i, Get(i));
+            }
+            return buffer;
+        }
+    };
 
-    // (**)
-    // just using a fixed size large enough for our testing setup
-    // would need to allocate and provide space from worker thread
-    static const int AMOUNT = 16;
+    // initial capacity, grows on demand
+    static const int64_t INITIAL_CAPACITY = 64;
+
+    // top and bottom on their own cache lines, thieves hammer top while the owner works on bottom
+    alignas(64) std::atomic<int64_t> mTop{ 0 };
+    alignas(64) std::atomic<int64_t> mBottom{ 0 };
+    alignas(64) std::atomic<RingBuffer*> mBuffer;
+
+    // buffers replaced by Grow(), a thief might still read from them
+    std::vector<RingBuffer*> mRetiredBuffers;
 
 #ifdef HTL_EXTRA_LOCKS
     using lock_guard = std::lock_guard<std::mutex>;
@@ -46,126 +101,139 @@ private:
 
 public:
     LocklessDeque()
+        : mBuffer(new RingBuffer(INITIAL_CAPACITY))
     {
-        // generational clash is the cause for malloc/free
-        // mEntries = new Job*[AMOUNT];
-        mEntries = (Job**)malloc(AMOUNT * sizeof(Job*));
     }
 
     ~LocklessDeque()
     {
-        // delete[] mEntries;
-        free(mEntries);
+        delete mBuffer.load();
+        for (RingBuffer* buffer : mRetiredBuffers)
+        {
+            delete buffer;
+        }
     }
 
     size_t Size() const
     {
-        int_fast32_t back = mBack;
-        int_fast32_t front = mFront;
-        if (back <= front) return 0;
+        int64_t bottom = mBottom.load(std::memory_order_relaxed);
+        int64_t top = mTop.load(std::memory_order_relaxed);
+        if (bottom <= top) return 0;
 
-        return (static_cast<size_t>(back) - front);
-    }
-
-    bool HasExecutableJobs() const
-    {
-#ifdef HTL_EXTRA_LOCKS
-        lock_guard lock(mJobDequeMutex);
-#endif
-        int_fast32_t back = mBack;
-        int_fast32_t front = mFront;
-        if (front < back)
-        {
-            for (size_t i = front; i < back; ++i)
-            {
-                if (mEntries[i]->CanExecute())
-                {
-                    return true;
-                }
-            }
-        }
-        return false;
+        return static_cast<size_t>(bottom - top);
     }
 
     void Clear()
     {
-        mBack = 0;
-        mFront = 0;
+        mTop.store(mBottom.load());
     }
 
-    void PushBack(Job* job)
+    // push to private end, only the owner may push
+    void Push(Job* job)
     {
 #ifdef HTL_EXTRA_LOCKS
         lock_guard lock(mJobDequeMutex);
 #endif
-        // naive way of adding and assume we are fine...
-        mEntries[mBack.fetch_add(1)] = job;
-        HTL_LOGT(ThreadId, "=> Pushed_back job " << job->GetName() << ", front: " << mFront << ", back: " << mBack);
+        int64_t bottom = mBottom.load(std::memory_order_relaxed);
+        int64_t top = mTop.load(std::memory_order_acquire);
+        RingBuffer* buffer = mBuffer.load(std::memory_order_relaxed);
+        if (bottom - top > buffer->Capacity - 1)
+        {
+            RingBuffer* grownBuffer = buffer->Grow(top, bottom);
+            mRetiredBuffers.push_back(buffer);
+            mBuffer.store(grownBuffer, std::memory_order_release);
+            buffer = grownBuffer;
+            HTL_LOGT(ThreadId, "=> Grown deque to capacity " << buffer->Capacity);
+        }
+
+        buffer->Put(bottom, job);
+        // the job has to be visible before a thief can see the new bottom
+        std::atomic_thread_fence(std::memory_order_release);
+        mBottom.store(bottom + 1, std::memory_order_relaxed);
+        HTL_LOGT(ThreadId, "=> Pushed job " << job->GetName() << ", top: " << top << ", bottom: " << bottom + 1);
     }
 
-    // pull from private FIFO end, allows to return not executable job for reordering
-    Job* PopFront(bool allowOpenDependencies = false)
+    // pull from private LIFO end
+    Job* Pop()
     {
 #ifdef HTL_EXTRA_LOCKS
         lock_guard lock(mJobDequeMutex);
 #endif
-        int_fast32_t front = mFront;
-        int_fast32_t back = mBack;
-        if (front < back && back > 0)
+        // reserve the bottom job first, so a thief can't take it while we look at it
+        int64_t bottom = mBottom.load(std::memory_order_relaxed) - 1;
+        RingBuffer* buffer = mBuffer.load(std::memory_order_relaxed);
+        mBottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = mTop.load(std::memory_order_relaxed);
+
+        Job* job = nullptr;
+        if (top <= bottom)
         {
-            Job* job = mEntries[front];
-            if (allowOpenDependencies || job->CanExecute())
+            job = buffer->Get(bottom);
+            if (top == bottom && !mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
             {
-                if (!mFront.compare_exchange_strong(front, front + 1))
-                {
-                    // concurrent thread changed front -> should not happen
-                    HTL_LOGTW(ThreadId, "COULD NOT POP FRONT -> FRONT changed");
-                    return nullptr;
-                }
-
-                HTL_LOGT(ThreadId, "<= Pop_front front: " << mFront << ", back: " << mBack);
-
-                // reset boundaries after popping last element
-                if (mFront == mBack && front != 0)
-                {
-                    mBack = 0;
-                    mFront = 0;
-                }
-                return job;
+                // last job was stolen in the meantime
+                HTL_LOGTW(ThreadId, "COULD NOT POP -> last job was stolen");
+                job = nullptr;
             }
         }
-        return nullptr; // queue empty or job not valid
+
+        // restore bottom if the deque is empty now
+        if (job == nullptr || top >= bottom)
+        {
+            mBottom.store(bottom + 1, std::memory_order_relaxed);
+        }
+
+        if (job)
+        {
+            HTL_LOGT(ThreadId, "<= Popped job " << job->GetName() << ", top: " << top << ", bottom: " << bottom);
+        }
+        return job;
     }
 
-    // pull from public LIFO end (stealing) or when Front was not executable
-    Job* PopBack()
+    // pull from public FIFO end (stealing)
+    Job* Steal()
     {
 #ifdef HTL_EXTRA_LOCKS
         lock_guard lock(mJobDequeMutex);
 #endif
-        int_fast32_t back = mBack;
-        int_fast32_t front = mFront;
-        if (front < back && back > 0)
+        int64_t top = mTop.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t bottom = mBottom.load(std::memory_order_acquire);
+        if (top < bottom)
         {
-            Job* job = mEntries[back - 1];
-            // do not return a job if cannot execute
-            if (!job->CanExecute())
+            Job* job = mBuffer.load(std::memory_order_acquire)->Get(top);
+            if (!mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
             {
+                // concurrent thread took the top job first
+                HTL_LOGTW(ThreadId, "COULD NOT STEAL -> TOP changed");
                 return nullptr;
             }
 
-            if (!mBack.compare_exchange_strong(back, back - 1))
+            HTL_LOGT(ThreadId, "<= Stole job " << job->GetName() << ", top: " << top + 1 << ", bottom: " << bottom);
+            return job;
+        }
+        return nullptr; // queue empty
+    }
+
+    // pull up to half of the jobs (rounded up) from the public end, at most maxCount, oldest first
+    // every job is claimed with its own CAS on top: claiming several slots with one CAS would race with the
+    // owner, who pops the bottom job without a CAS as long as it sees more than one job.
+    // Stops at the first failed CAS, so it returns the number of jobs actually taken
+    size_t StealHalf(Job** jobs, size_t maxCount)
+    {
+        size_t count = std::min((Size() + 1) / 2, maxCount);
+        size_t stolen = 0;
+        while (stolen < count)
+        {
+            Job* job = Steal();
+            if (job == nullptr)
             {
-                // concurrent thread changed back -> main_looper called PushBack
-                HTL_LOGTW(ThreadId, "COULD NOT POP BACK -> BACK changed");
-                return nullptr;
+                break;
             }
-
-            HTL_LOGT(ThreadId, "<= Pop_back front: " << mFront << ", back: " << mBack);
-
-            return job;
+            jobs[stolen++] = job;
         }
-        return nullptr; // queue already empty
+        return stolen;
     }
 
     // Debug functionality for printing additional information
@@ -177,12 +245,13 @@ public:
 #ifdef HTL_EXTRA_LOCKS
         lock_guard lock(mJobDequeMutex);
 #endif
-        int_fast32_t front = mFront;
-        int_fast32_t back = mBack;
-        HTL_LOG(" -> Current deque with boundaries: " << front << " - " << back << " (" << (back - front) << "): ");
-        for (size_t i = front; i < back; ++i)
+        int64_t top = mTop.load();
+        int64_t bottom = mBottom.load();
+        RingBuffer* buffer = mBuffer.load();
+        HTL_LOG(" -> Current deque with boundaries: " << top << " - " << bottom << " (" << (bottom - top) << "), capacity: " << buffer->Capacity << ": ");
+        for (int64_t i = top; i < bottom; ++i)
         {
-            HTL_LOG("\t" << mEntries[i]->GetName() << " - " << mEntries[i]->GetUnfinishedJobs());
+            HTL_LOG("\t" << buffer->Get(i)->GetName() << " - " << buffer->Get(i)->GetUnfinishedJobs());
         }
     }
-};
\ No newline at end of file
+};
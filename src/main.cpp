@@ -7,11 +7,6 @@
 // ===================
 // - Measure and put results in README.md (nice to have)
 
-// optional
-// ------------
-// (*) Fix LIFO / FIFO for private/public end (for better performance)
-// (**) Allocate enough memory from outside and provide, allow resize/shrink
-
 // further improvements
 // ------------------------
 // - Notify when jobs are finished
@@ -40,6 +35,9 @@
 //    but this was not enough because if other threads work longer on jobs which have dependencies,
 //    the reordering can still happen on the current active thread
 //    A (hopefully) final solution was to reset the boundaries every time the queue pops its last item.
+// -------------------------------------------------------------------------------------------------------
+//    In the end we turned it around: a job only enters a queue once its last dependency finished
+//    (see Job::Finish), so blocked jobs never occupy a queue slot and nothing has to be reordered anymore.
 
 // o Another Problem were spurious wakeups, where the workers gets notified by the conditional and want to start
 //    working because their queue size > 0. But as they try to get an executable job, it turns out all of them are not executable
@@ -74,7 +72,9 @@
 #include "../optick/src/optick.h"
 
 #include "argument_parser.h"
+#include "benchmark.h"
 #include "defines.h"
+#include "job_graph.h"
 #include "job_system.h"
 
 
@@ -124,19 +124,22 @@ MAKE_UPDATE_FUNC(Sound, 1000) // no dependencies
 //									particles
 //									-> 800
 // ----------------------------------------------------------------------------------------------
+// JobGraph::Build() computes this bound from the durations passed to AddNode (the critical path)
+// and dispatches jobs with the longest remaining chain first
+// ----------------------------------------------------------------------------------------------
 
 void UpdateSerial()
 {
 	OPTICK_EVENT();
 
-	// Test if adding rendering first still respect order
-	UpdateRendering();
+	// single threaded reference, one update after the other in dependency order
 	UpdateInput();
 	UpdatePhysics();
 	UpdateCollision();
 	UpdateAnimation();
 	UpdateParticles();
 	UpdateGameElements();
+	UpdateRendering();
 	UpdateSound();
 
 	HTL_LOGD("All jobs done!");
@@ -146,6 +149,43 @@ void UpdateSerial()
 std::mutex ThreadSafeLogger::mMutex;
 ThreadSafeLogger ThreadSafeLogger::Logger;
 
+// the frame graph never changes, so we build it once and only submit it every frame
+void BuildFrameGraph(JobGraph& graph)
+{
+	HTL_LOGD("---------- BUILDING FRAME GRAPH ----------");
+
+	// the nodes are added in a scrambled order on purpose (rendering first), Build() sorts them topologically anyway
+	// the chain input -> physics -> gameElements -> rendering (5600 microsec) decides the frame time,
+	// collision -> animation / particles has 400 microsec slack and sound doesn't block anybody
+	// workers drain priorities before the dispatch order, so the critical chain also gets the most urgent priorities
+	// costs are the durations in microseconds, the graph derives the critical path and the dispatch order from them
+	JobGraph::NodeId rendering = graph.AddNode(&UpdateRendering, "rendering", JobPriority::Critical, 2000);
+	JobGraph::NodeId collision = graph.AddNode(&UpdateCollision, "collision", JobPriority::High, 1200);
+	JobGraph::NodeId physics = graph.AddNode(&UpdatePhysics, "physics", JobPriority::Critical, 1000);
+	JobGraph::NodeId input = graph.AddNode(&UpdateInput, "input", JobPriority::Critical, 200);
+	JobGraph::NodeId animation = graph.AddNode(&UpdateAnimation, "animation", JobPriority::Normal, 600);
+	JobGraph::NodeId particles = graph.AddNode(&UpdateParticles, "particles", JobPriority::Normal, 800);
+	JobGraph::NodeId gameElements = graph.AddNode(&UpdateGameElements, "gameElements", JobPriority::Critical, 2400);
+	graph.AddNode(&UpdateSound, "sound", JobPriority::Background, 1000);
+
+#ifdef HTL_TEST_DEPENDENCIES
+	graph.AddDependency(input, physics);
+	graph.AddDependency(physics, collision);
+	graph.AddDependency(physics, gameElements);
+	graph.AddDependency(collision, animation);
+	graph.AddDependency(collision, particles);
+	graph.AddDependency(animation, rendering);
+	graph.AddDependency(particles, rendering);
+	graph.AddDependency(gameElements, rendering);
+#endif
+
+	if (graph.Build())
+	{
+		HTL_LOG("Frame graph critical path: " << graph.GetCriticalPathLength() << " microsec, reached with "
+			<< graph.GetMaxUsefulWorkers() << " threads, more can't make a frame faster");
+	}
+}
+
 /*
 * ===============================================================
 * In `UpdateParallel` you should use your jobsystem to distribute
@@ -153,70 +193,24 @@ ThreadSafeLogger ThreadSafeLogger::Logger;
 * as you see fit for your implementation (to avoid global state)
 * ===============================================================
 */
-void UpdateParallel(JobSystem& jobSystem)
+void UpdateParallel(JobSystem& jobSystem, JobGraph& frameGraph)
 {
 	OPTICK_EVENT();
 
-	HTL_LOGD("---------- CREATING JOBS ----------");
-	std::vector<Job*> jobs;
+	HTL_LOGD("---------- SUBMITTING JOBS ----------");
+	frameGraph.Submit(jobSystem);
 
-#ifdef HTL_TEST_DEPENDENCIES
-	// Test if adding rendering first still respect dependencies
-	Job* sound = new Job(&UpdateSound, "sound");
-	Job* rendering = new Job(&UpdateRendering, "rendering");
-	Job* animation = new Job(&UpdateAnimation, "animation", { rendering });
-	Job* gameElements = new Job(&UpdateGameElements, "gameElements", { rendering });
-	Job* particles = new Job(&UpdateParticles, "particles", { rendering });
-	Job* collision = new Job(&UpdateCollision, "collision", { animation, particles });
-	Job* physics = new Job(&UpdatePhysics, "physics", { collision, gameElements });
-	Job* input = new Job(&UpdateInput, "input", { physics });
-
-	jobs.push_back(rendering);
-	jobs.push_back(collision);
-	jobs.push_back(physics);
-	jobs.push_back(input);
-	jobs.push_back(animation);
-	jobs.push_back(particles);
-	jobs.push_back(gameElements);
-	jobs.push_back(sound);
-#else
-	jobs.push_back(new Job(&UpdateRendering, "rendering"));
-	jobs.push_back(new Job(&UpdateCollision, "collision"));
-	jobs.push_back(new Job(&UpdatePhysics, "physics"));
-	jobs.push_back(new Job(&UpdateInput, "input"));
-	jobs.push_back(new Job(&UpdateAnimation, "animation"));
-	jobs.push_back(new Job(&UpdateParticles, "particles"));
-	jobs.push_back(new Job(&UpdateGameElements, "gameElements"));
-	jobs.push_back(new Job(&UpdateSound, "sound"));
-#endif
+	// help executing jobs until the frame is done
+	frameGraph.Wait(jobSystem);
+	HTL_LOGD("All jobs done on main thread #" << std::this_thread::get_id() << "...");
 
-#ifdef HTL_SORT_JOBS
-	// sorting jobs by dependency so every thread can start directly
-	// and there are no spurious wakeups, where a thread awakes because the queue is not empty
-	// but than can complete no work because all jobs have open dependencies
-	std::sort(jobs.begin(), jobs.end(), [](Job* l, Job* r) {
-		// (*) different implementation until LIFO / FIFO order is unified
-		#ifdef HTL_USING_LOCKLESS
-			return l->GetUnfinishedJobs() < r->GetUnfinishedJobs();
-		#else
-			return l->GetUnfinishedJobs() > r->GetUnfinishedJobs();
-		#endif
-	});
+#ifdef HTL_JOB_STATS
+	// the measured durations replace the estimates, so the dispatch order follows the real critical path
+	frameGraph.UpdateCosts(jobSystem.GetJobStats());
 #endif
 
-	for (uint32_t i = 0; i < jobs.size(); i++)
-	{
-		jobSystem.AddJob(jobs[i]);
-	}
-
-	while (!jobSystem.AllJobsFinished());
-	HTL_LOGD("All jobs done on main thread #" << std::this_thread::get_id() << "...");
-
-	HTL_LOGD("---------- DELETING JOBS ----------");
-	for (uint32_t i = 0; i < jobs.size(); i++)
-	{
-		delete jobs[i];
-	}
+	// frees jobs created during the frame, e.g. the splits of a ParallelFor
+	jobSystem.ResetJobs();
 }
 
 uint32_t GetNumThreads(const ArgumentParser& argParser)
@@ -254,6 +248,38 @@ uint32_t GetNumThreads(const ArgumentParser& argParser)
 	return threads;
 }
 
+AffinityPolicy GetAffinityPolicy(const ArgumentParser& argParser)
+{
+	AffinityPolicy policy = AffinityPolicy::Compact;
+	if (argParser.CheckIfExists("-a", "--affinity"))
+	{
+		std::string name = argParser.GetString("-a", "--affinity");
+		if (!CpuTopology::ParseAffinityPolicy(name, policy))
+		{
+			HTL_LOG("Unknown affinity policy " << name << "! Defaulting to: " << CpuTopology::ToString(policy));
+		}
+	}
+	return policy;
+}
+
+// idle workers spin for up to this many iterations before yielding and parking, 0 disables spinning
+// the budget still adapts to the gaps between jobs unless a fixed budget is requested
+void SetIdleSettings(const ArgumentParser& argParser, JobSystem& jobSystem)
+{
+	IdleSettings settings = jobSystem.GetIdleSettings();
+	if (argParser.CheckIfExists("-s", "--spin"))
+	{
+		int spinIterations = argParser.GetInt("-s", "--spin");
+		settings.SpinIterations = spinIterations > 0 ? static_cast<uint32_t>(spinIterations) : 0;
+	}
+	if (argParser.CheckIfExists("-f", "--fixed-spin"))
+	{
+		settings.Adaptive = false;
+	}
+	HTL_LOG("Idle workers spin up to " << settings.SpinIterations << " iterations (" << (settings.Adaptive ? "adaptive" : "fixed") << ")");
+	jobSystem.SetIdleSettings(settings);
+}
+
 int main(int argc, char** argv)
 {
 	/*
@@ -272,12 +298,21 @@ int main(int argc, char** argv)
 	OPTICK_THREAD("MainThread");
 
 	ArgumentParser argParser(argc, argv);
+	if (argParser.CheckIfExists("-b", "--benchmark"))
+	{
+		Benchmark benchmark(GetNumThreads(argParser));
+		benchmark.Run();
+		OPTICK_SHUTDOWN();
+		return 0;
+	}
+
 	isRunningParallel = argParser.CheckIfExists("-p", "--parallel") ? true : isRunningParallel;
 	JobSystem* jobSystem = nullptr; // no need to allocate JobSystem when running Serial
 	uint32_t numThreads = 1;
 	if (isRunningParallel) {
 		numThreads = GetNumThreads(argParser);
-		jobSystem = new JobSystem(numThreads);
+		jobSystem = new JobSystem(numThreads, GetAffinityPolicy(argParser));
+		SetIdleSettings(argParser, *jobSystem);
 	}
 
 	std::atomic<bool> isRunning = true;
@@ -286,12 +321,18 @@ int main(int argc, char** argv)
 	{
 		OPTICK_THREAD("Update");
 
+		JobGraph frameGraph;
+		if ( isRunningParallel )
+		{
+			BuildFrameGraph(frameGraph);
+		}
+
 		while ( isRunning )
 		{
 			OPTICK_FRAME("Frame");
 			if ( isRunningParallel )
 			{
-				UpdateParallel(*jobSystem);
+				UpdateParallel(*jobSystem, frameGraph);
 #ifdef HTL_TEST_ONLY_ONE_FRAME
 				return;
 #endif
@@ -319,12 +360,24 @@ int main(int argc, char** argv)
 	HTL_LOG("Quitting...");
 	isRunning = false;
 
-	HTL_LOG("Shutting down all worker threads...");
-	jobSystem->ShutDown();
-
+	// let the current frame finish first, its jobs are deleted once they are done
 	HTL_LOG("Waiting for main_runner to join...");
 	main_runner.join();
 
+	if (jobSystem != nullptr)
+	{
+		HTL_LOG("Shutting down all worker threads...");
+		jobSystem->ShutDown();
+#ifdef HTL_JOB_STATS
+		jobSystem->GetJobStats().Print();
+		if (argParser.CheckIfExists("-m", "--metrics"))
+		{
+			jobSystem->GetJobStats().WriteCsv(argParser.GetString("-m", "--metrics"));
+		}
+#endif
+		delete jobSystem;
+	}
+
 	OPTICK_SHUTDOWN();
 }
 
@@ -1,14 +1,55 @@
 #include "random.h"
 
-#include <stdlib.h> // srand, rand
-#include <time.h>   //time
+#include <atomic>
+#include <chrono>
+
+static std::atomic<uint64_t> sInstanceCounter{ 0 };
 
 Random::Random()
 {
-    srand((unsigned)time(0));
+    uint64_t time = static_cast<uint64_t>(std::chrono::high_resolution_clock::now().time_since_epoch().count());
+    Seed(time + sInstanceCounter.fetch_add(1, std::memory_order_relaxed));
+}
+
+Random::Random(uint64_t seed)
+{
+    Seed(seed);
+}
+
+void Random::Seed(uint64_t seed)
+{
+    // splitmix64 spreads similar seeds over the whole state, xorshift must not start at 0
+    uint64_t z = seed + 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z = z ^ (z >> 31);
+    mState = z != 0 ? z : 0x9E3779B97F4A7C15ull;
+}
+
+uint32_t Random::Next()
+{
+    uint64_t x = mState;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    mState = x;
+    return static_cast<uint32_t>((x * 0x2545F4914F6CDD1Dull) >> 32);
 }
 
 uint32_t Random::Rand(uint32_t min, uint32_t max)
 {
-    return rand() % max + min;
-}
\ No newline at end of file
+    uint32_t range = max - min;
+    uint64_t product = static_cast<uint64_t>(Next()) * range;
+    uint32_t low = static_cast<uint32_t>(product);
+    if (low < range)
+    {
+        // reject the few values that would make some results more likely than others
+        uint32_t threshold = (0u - range) % range;
+        while (low < threshold)
+        {
+            product = static_cast<uint64_t>(Next()) * range;
+            low = static_cast<uint32_t>(product);
+        }
+    }
+    return min + static_cast<uint32_t>(product >> 32);
+}
@@ -1,10 +1,28 @@
 #pragma once
 #include <stdint.h>
 
+// general information
+// ===================
+// - Small xorshift64* generator, every thread that needs random numbers owns one
+//      rand() has hidden global state and glibc serializes it with a lock, so workers picking victims
+//      with it would contend on that lock exactly while they are idle and looking for work
+// - Rand() maps to a range without modulo bias (Lemire's multiply and shift with rejection)
+// - Not a cryptographic generator, only good enough for picking victims
+
 class Random
 {
 public:
+    // seeds from the clock and an instance counter, so generators created at the same time differ
     Random();
+    explicit Random(uint64_t seed);
+
+    void Seed(uint64_t seed);
 
+    uint32_t Next();
+
+    // uniform in [min, max), max has to be bigger than min
     uint32_t Rand(uint32_t min, uint32_t max);
-};
\ No newline at end of file
+
+private:
+    uint64_t mState;
+};